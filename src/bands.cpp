@@ -0,0 +1,75 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "bands.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace bands {
+
+BandedRenderer::BandedRenderer(PixelBuffer& pb, int band_count, int thread_count)
+    : pb(pb)
+    , thread_count(std::clamp(thread_count, 1, std::max(band_count, 1)))
+    , start(this->thread_count)
+    , done(this->thread_count)
+{
+    if (band_count < 1 || band_count > pb.GetSize().height)
+        throw std::runtime_error("invalid number of bands");
+
+    const auto height = pb.GetSize().height;
+    for (int n = 0; n < band_count; ++n) {
+        const auto top = n * height / band_count;
+        const auto bottom = (n + 1) * height / band_count;
+        bands.push_back(std::make_unique<PixelBuffer>(pb, Rectangle{{0, top}, {pb.GetSize().width, bottom - top}}));
+    }
+    for (int n = 1; n < this->thread_count; ++n)
+        workers.emplace_back([this, n] { Worker(n); });
+}
+
+BandedRenderer::~BandedRenderer()
+{
+    stopping = true;
+    start.arrive_and_wait();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void BandedRenderer::RenderBands(int n)
+{
+    for (; n < static_cast<int>(bands.size()); n += thread_count)
+        (*draw)(*bands[n]);
+}
+
+void BandedRenderer::Worker(int n)
+{
+    while (true) {
+        start.arrive_and_wait();
+        if (stopping)
+            return;
+        RenderBands(n);
+        done.arrive_and_wait();
+    }
+}
+
+void BandedRenderer::Render(const std::function<void(PixelBuffer&)>& draw)
+{
+    // pb may have moved to another framebuffer page since the last frame;
+    // the bands read its stale map as it is
+    for (auto& band : bands)
+        band->buffer = pb.buffer;
+
+    this->draw = &draw;
+    start.arrive_and_wait();
+    RenderBands(0);
+    done.arrive_and_wait();
+
+    for (auto& band : bands) {
+        pb.damage.Add(band->damage);
+        band->damage.Reset();
+    }
+}
+
+}
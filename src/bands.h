@@ -0,0 +1,49 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <barrier>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "pixelbuffer.h"
+
+namespace bands {
+
+// Renders frames as horizontal bands, spread over a pool of threads that
+// persists between frames; the calling thread renders bands as well
+class BandedRenderer {
+    PixelBuffer& pb;
+    // Views of pb, one per band
+    std::vector<std::unique_ptr<PixelBuffer>> bands;
+    const int thread_count;
+    const std::function<void(PixelBuffer&)>* draw{};
+    bool stopping{};
+    std::barrier<> start;
+    std::barrier<> done;
+    std::vector<std::thread> workers;
+
+    // Thread n renders bands n, n + thread_count, ...
+    void RenderBands(int n);
+    void Worker(int n);
+
+public:
+    BandedRenderer(PixelBuffer& pb, int band_count, int thread_count);
+    ~BandedRenderer();
+
+    BandedRenderer(const BandedRenderer&) = delete;
+    BandedRenderer& operator=(const BandedRenderer&) = delete;
+
+    int GetThreadCount() const { return thread_count; }
+
+    // Calls draw once per band, with a view of pb clipped to that band, and
+    // waits for all bands; what they drew is added to the damage of pb
+    void Render(const std::function<void(PixelBuffer&)>& draw);
+};
+
+}
@@ -0,0 +1,913 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bands.h"
+#include "blend.h"
+#include "compositor.h"
+#include "convert.h"
+#include "effects.h"
+#include "font.h"
+#include "framebuffer.h"
+#include "image.h"
+#include "indexed.h"
+#include "pixelbuffer.h"
+#include "sprite.h"
+#include "types.h"
+#include "util.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps the compiler from discarding work whose result is never read
+void Escape(const void* p) { asm volatile("" : : "g"(p) : "memory"); }
+
+// Set by benchmarks whose results are unacceptable; makes the exit status 1
+bool failed = false;
+
+// Runs fn repeatedly for half a second and reports the time per iteration,
+// which is also returned
+template<typename Fn>
+double Measure(std::string_view name, Fn fn)
+{
+    fn();
+    int iterations = 0;
+    const auto start = Clock::now();
+    auto now = start;
+    do {
+        fn();
+        ++iterations;
+        now = Clock::now();
+    } while (now - start < std::chrono::milliseconds{500});
+    const auto us = std::chrono::duration<double, std::micro>(now - start).count() / iterations;
+    std::printf("%-48s %10.2f us/iter\n", std::string(name).c_str(), us);
+    return us;
+}
+
+PixelBuffer MakeTestFrame(const Size& size)
+{
+    PixelBuffer pb(size);
+    for (int y = 0; y < size.height; ++y) {
+        for (int x = 0; x < size.width; ++x) {
+            pb.buffer[y * size.width + x] = Colour{x & 0xff, y & 0xff, (x ^ y) & 0xff};
+        }
+    }
+    return pb;
+}
+
+void BenchPresent()
+{
+    for (const auto size : { Size{320, 240}, Size{1920, 1080} }) {
+        const auto pb = MakeTestFrame(size);
+        const auto pixels = size.width * size.height;
+        std::vector<uint32_t> fb32(pixels);
+        std::vector<uint16_t> fb16(pixels);
+        const auto suffix = " " + std::to_string(size.width) + "x" + std::to_string(size.height);
+        const convert::RGB565Layout layout;
+
+        Measure("present 32bpp copy" + suffix, [&] {
+            memcpy(fb32.data(), pb.buffer, pixels * 4);
+            Escape(fb32.data());
+        });
+        Measure("present 16bpp" + suffix, [&] {
+            for (int y = 0; y < size.height; ++y)
+                convert::ToRGB565(&fb16[y * size.width], &pb.buffer[y * size.width], size.width, layout);
+            Escape(fb16.data());
+        });
+        Measure("present 16bpp dithered" + suffix, [&] {
+            for (int y = 0; y < size.height; ++y)
+                convert::ToRGB565Dithered(&fb16[y * size.width], &pb.buffer[y * size.width], size.width, 0, y, layout);
+            Escape(fb16.data());
+        });
+    }
+}
+
+// Copperbar::Update as it was before span fills: a Bresenham line with a
+// bounds-checked PutPixel() for every pixel of every row
+void CopperbarPerPixel(PixelBuffer& pb, int y, int half_height, const Colour& from, const Colour& to)
+{
+    const auto row = [&](int row_y, const Colour& c) {
+        Point current{0, row_y};
+        const Point end{pb.GetSize().width, row_y};
+        while (true) {
+            pb.PutPixel(current, c);
+            if (current == end)
+                break;
+            ++current.x;
+        }
+    };
+    for (int j = 0; j < half_height; ++j)
+        row(y - half_height + j, Blend(from, to, static_cast<float>(j) / static_cast<float>(half_height)));
+    for (int j = 0; j < half_height; ++j)
+        row(y + j, Blend(to, from, static_cast<float>(j) / static_cast<float>(half_height)));
+}
+
+// Copperbar::Draw as it was before the copper engine: a blend and a span
+// fill for every row of every bar
+void CopperbarSpans(PixelBuffer& pb, int y, int half_height, const Colour& from, const Colour& to)
+{
+    const Span row{0, pb.GetSize().width};
+    for (int j = 0; j < half_height; ++j) {
+        const auto alpha = j * 255 / half_height;
+        pb.FillSpan(y - half_height + j, row, BlendPixel(from, to, alpha));
+        pb.FillSpan(y + j, row, BlendPixel(to, from, alpha));
+    }
+}
+
+void AddBars(effects::Copper& copper, int count)
+{
+    for (int n = 0; n < count; ++n) {
+        const Colour c{(n % 3 == 0) * 255, (n % 3 == 1) * 255, (n % 3 == 2) * 255};
+        copper.Add({ 20, {0, 0, 0}, c, 70, 40, 160, n * 160 / count });
+    }
+}
+
+void BenchCopperbar()
+{
+    for (const auto size : { Size{320, 240}, Size{1920, 1080} }) {
+        PixelBuffer pb(size);
+        const auto suffix = " " + std::to_string(size.width) + "x" + std::to_string(size.height);
+
+        int y = 40;
+        Measure("copperbar per-pixel" + suffix, [&] {
+            y = 40 + (y + 1) % 80;
+            CopperbarPerPixel(pb, y, 10, {0, 0, 0}, {255, 0, 0});
+            CopperbarPerPixel(pb, y + 20, 10, {0, 0, 0}, {0, 255, 0});
+            CopperbarPerPixel(pb, y + 40, 10, {0, 0, 0}, {0, 0, 255});
+            pb.EndFrame();
+            Escape(pb.buffer);
+        });
+
+        Measure("copperbar span fill" + suffix, [&] {
+            y = 40 + (y + 1) % 80;
+            CopperbarSpans(pb, y, 10, {0, 0, 0}, {255, 0, 0});
+            CopperbarSpans(pb, y + 20, 10, {0, 0, 0}, {0, 255, 0});
+            CopperbarSpans(pb, y + 40, 10, {0, 0, 0}, {0, 0, 255});
+            pb.EndFrame();
+            Escape(pb.buffer);
+        });
+
+        effects::Copper copper(size.height);
+        AddBars(copper, 3);
+        Measure("copperbar copper" + suffix, [&] {
+            copper.Update(pb);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        });
+
+        // Many overlapping bars still fill every row once
+        effects::Copper many(size.height);
+        AddBars(many, 32);
+        Measure("copperbar copper 32 bars" + suffix, [&] {
+            many.Update(pb);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        });
+    }
+}
+
+// Largest per-channel difference between the colours of a and b
+int ChannelError(const PixelValue a, const PixelValue b)
+{
+    int error = 0;
+    for (int shift = 0; shift < 24; shift += 8)
+        error = std::max(error, std::abs(static_cast<int>((a >> shift) & 0xff) - static_cast<int>((b >> shift) & 0xff)));
+    return error;
+}
+
+// Checks the blend kernels against the floating point Blend() they
+// replace; returns the largest per-channel difference of each. None of the
+// counts are a multiple of the vector width, so the scalar tails are
+// checked as well
+std::array<int, 4> BlendErrors()
+{
+    uint32_t seed = 1;
+    const auto next = [&] { seed = seed * 1664525 + 1013904223; return seed; };
+    constexpr int Stride = 3;
+    std::array<int, 4> max_error{};
+    for (const int count : { 1, 7, 13, 33, 67, 1021 }) {
+        std::vector<PixelValue> row(count * Stride), source(count), expected(row.size());
+        std::vector<uint8_t> mask(count), coverage(count);
+        for (int round = 0; round < 64; ++round) {
+            const PixelValue colour = next() | 0xff000000;
+            for (int n = 0; n < count; ++n) {
+                mask[n] = n < 256 && round == 0 ? static_cast<uint8_t>(n) : static_cast<uint8_t>(next() >> 24);
+                source[n] = next();
+            }
+
+            // blend::Mask(), on every pixel
+            for (auto& p : row)
+                p = next() | 0xff000000;
+            for (int n = 0; n < count; ++n)
+                expected[n] = Blend(FromPixelValue(row[n]), FromPixelValue(colour), mask[n] / 255.0);
+            blend::Mask(row.data(), mask.data(), colour, count);
+            for (int n = 0; n < count; ++n)
+                max_error[0] = std::max(max_error[0], ChannelError(row[n], expected[n]));
+
+            // blend::MaskColumn(), on every Stride-th pixel; the others
+            // must be left alone
+            for (size_t n = 0; n < row.size(); ++n) {
+                row[n] = next() | 0xff000000;
+                expected[n] = row[n];
+            }
+            for (int n = 0; n < count; ++n)
+                expected[n * Stride] = Blend(FromPixelValue(row[n * Stride]), FromPixelValue(colour), mask[n] / 255.0);
+            blend::MaskColumn(row.data(), Stride, mask.data(), colour, count);
+            for (size_t n = 0; n < row.size(); ++n)
+                max_error[1] = std::max(max_error[1], n % Stride == 0 ? ChannelError(row[n], expected[n]) : row[n] == expected[n] ? 0 : 255);
+
+            // blend::Alpha()
+            for (int n = 0; n < count; ++n) {
+                row[n] = next() | 0xff000000;
+                expected[n] = Blend(FromPixelValue(row[n]), FromPixelValue(source[n]), (source[n] >> 24) / 255.0);
+            }
+            blend::Alpha(row.data(), source.data(), count);
+            for (int n = 0; n < count; ++n)
+                max_error[2] = std::max(max_error[2], ChannelError(row[n], expected[n]));
+
+            // blend::DistanceToCoverage()
+            const int gain = 1 + static_cast<int>(next() >> 22);
+            blend::DistanceToCoverage(coverage.data(), mask.data(), gain, count);
+            for (int n = 0; n < count; ++n) {
+                const auto v = std::clamp(128 + (mask[n] - 128) * gain / 64.0, 0.0, 255.0);
+                max_error[3] = std::max(max_error[3], static_cast<int>(std::ceil(std::abs(coverage[n] - v))));
+            }
+        }
+    }
+    return max_error;
+}
+
+void BenchBlend()
+{
+    const auto errors = BlendErrors();
+    const char* names[] = { "mask", "mask column", "alpha", "distance to coverage" };
+    for (size_t n = 0; n < errors.size(); ++n) {
+        const auto name = std::string("blend max error ") + names[n];
+        std::printf("%-48s %10d\n", name.c_str(), errors[n]);
+        if (errors[n] > 1) {
+            std::printf("%-48s exceeds 1\n", name.c_str());
+            failed = true;
+        }
+    }
+
+    PixelBuffer pb(Size{320, 240});
+    std::vector<uint8_t> mask(pb.GetSize().width * pb.GetSize().height);
+    for (size_t n = 0; n < mask.size(); ++n)
+        mask[n] = static_cast<uint8_t>(n * 7);
+    const Colour colour{255, 255, 255};
+
+    Measure("blend 320x240 per-pixel double", [&] {
+        for (int y = 0; y < pb.GetSize().height; ++y) {
+            for (int x = 0; x < pb.GetSize().width; ++x) {
+                const auto v = mask[y * pb.GetSize().width + x] / 255.0;
+                pb.PutPixel({x, y}, Blend(pb.GetPixel({x, y}), colour, v));
+            }
+        }
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+    Measure("blend 320x240 mask rows", [&] {
+        for (int y = 0; y < pb.GetSize().height; ++y) {
+            blend::Mask(&pb.buffer[y * pb.GetSize().width], &mask[y * pb.GetSize().width], colour, pb.GetSize().width);
+        }
+        Escape(pb.buffer);
+    });
+}
+
+// Fonts are found relative to the build directory, as with partyplayer
+font::Font LoadFont(const char* name, int size)
+{
+    return font::Font(util::ReadFile((std::string("../data/") + name).c_str()), size);
+}
+
+void BenchScroller()
+{
+    PixelBuffer pb(Size{320, 240});
+    auto font = LoadFont("Roboto-Regular.ttf", 70);
+    const std::string text = "Daft Punk / Discovery / One More Time (Radio Edit)";
+
+    int x = 0;
+    Measure("scroller 70px per-pixel glyphs per frame", [&] {
+        // Glyph drawing as it was originally: GetPixel/Blend/PutPixel
+        x = (x + 2) % 1000;
+        Point current{-x, 130};
+        for (const auto ch : text) {
+            const auto& glyph = font.GetGlyph(ch);
+            const Point renderPoint{current + Point{0, font.GetBaseLine() + glyph.y0}};
+            for (int y = 0; y < glyph.height; ++y) {
+                for (int x = 0; x < glyph.width; ++x) {
+                    const auto v = glyph.bitmap[y * glyph.width + x] / 255.0;
+                    const auto currentPixel = pb.GetPixel(renderPoint + Point{x, y});
+                    pb.PutPixel(renderPoint + Point{x, y}, Blend(currentPixel, Colour{255, 255, 255}, v));
+                }
+            }
+            current.x += glyph.advance >> font::FixedShift;
+        }
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+    Measure("scroller 70px DrawText per frame", [&] {
+        x = (x + 2) % 1000;
+        font::DrawText(pb, font, {-x, 130}, {255, 255, 255}, text);
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+
+    effects::Scroller scroller(font);
+    scroller.direction = effects::ScrollDirection::RightToLeft;
+    scroller.speed = 2;
+    scroller.SetText(text);
+    Measure("scroller 70px pre-rendered strip", [&] {
+        scroller.Update(pb, {255, 255, 255}, 130);
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+
+    // The same strip, a column at a time
+    scroller.wave_amplitude = 20;
+    Measure("scroller 70px wave", [&] {
+        scroller.Update(pb, {255, 255, 255}, 130);
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+}
+
+void BenchText()
+{
+    // A long title as the scroller sees it: mostly outside the screen
+    PixelBuffer pb(Size{320, 240});
+    auto font = LoadFont("Roboto-Regular.ttf", 70);
+    std::string text;
+    while (text.size() < 200)
+        text += "Godspeed You! Black Emperor / Lift Your Skinny Fists Like Antennas to Heaven / ";
+    text.resize(200);
+
+    int x = 0;
+    Measure("text 200 chars 70px per-pixel glyphs", [&] {
+        x = (x + 2) % 1000;
+        Point current{-x, 130};
+        for (const auto ch : text) {
+            const auto& glyph = font.GetGlyph(ch);
+            const Point renderPoint{current + Point{0, font.GetBaseLine() + glyph.y0}};
+            for (int y = 0; y < glyph.height; ++y) {
+                for (int x = 0; x < glyph.width; ++x) {
+                    const auto v = glyph.bitmap[y * glyph.width + x] / 255.0;
+                    const auto currentPixel = pb.GetPixel(renderPoint + Point{x, y});
+                    pb.PutPixel(renderPoint + Point{x, y}, Blend(currentPixel, Colour{255, 255, 255}, v));
+                }
+            }
+            current.x += glyph.advance >> font::FixedShift;
+        }
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+    Measure("text 200 chars 70px DrawText", [&] {
+        x = (x + 2) % 1000;
+        font::DrawText(pb, font, {-x, 130}, {255, 255, 255}, text);
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+    Measure("text 200 chars 70px DrawText clipped to 100x40", [&] {
+        x = (x + 2) % 1000;
+        font::DrawText(pb, font, {-x, 130}, {255, 255, 255}, text, Rectangle{{110, 140}, {100, 40}});
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+    Measure("text 200 chars GetTextWidth", [&] {
+        auto width = font::GetTextWidth(font, text);
+        Escape(&width);
+    });
+}
+
+void BenchSdf()
+{
+    PixelBuffer pb(Size{640, 240});
+    const auto data = util::ReadFile("../data/Roboto-Regular.ttf");
+    const std::string text = "One More Time";
+
+    Measure("sdf font construction", [&] {
+        font::SdfFont font(data);
+        Escape(&font);
+    });
+    const font::SdfFont sdf(data);
+    for (const auto size : { 20, 70, 120 }) {
+        const auto prefix = "text " + std::to_string(size) + "px ";
+        Measure(prefix + "bitmap font construction", [&] {
+            font::Font font(data, size);
+            Escape(&font);
+        });
+        font::Font bitmap(data, size);
+        Measure(prefix + "bitmap DrawText", [&] {
+            font::DrawText(pb, bitmap, {0, 0}, {255, 255, 255}, text);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        });
+        Measure(prefix + "sdf DrawText", [&] {
+            font::DrawText(pb, sdf, {0, 0}, {255, 255, 255}, text, size);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        });
+    }
+}
+
+void BenchLogo()
+{
+    PixelBuffer pb(Size{320, 240});
+    const auto image = image::Decode(util::ReadFile("../data/logo.png"));
+    const Point p{(pb.GetSize().width - image.GetSize().width) / 2, 57};
+
+    Measure("logo per-pixel colour key", [&] {
+        // PlotLogo as it was originally
+        pb.MarkDamaged({ p, image.GetSize() });
+        for (int y = 0; y < image.GetSize().height; ++y) {
+            for (int x = 0; x < image.GetSize().width; ++x) {
+                auto dest = &pb.buffer[(p.y + y) * pb.GetSize().width + p.x + x];
+                auto source = &image.buffer[y * image.GetSize().width + x];
+                if (*source != 0xffffffff)
+                    *dest = *source;
+            }
+        }
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+
+    const sprite::Sprite keyed(image, 0xffffffff);
+    Measure("logo sprite runs", [&] {
+        keyed.Draw(pb, p);
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+
+    // The same logo with every pixel half transparent
+    PixelBuffer translucent(image.GetSize());
+    for (int n = 0; n < image.GetSize().width * image.GetSize().height; ++n)
+        translucent.buffer[n] = (image.buffer[n] & 0xffffff) | 0x80000000;
+    const sprite::Sprite alpha(translucent);
+    Measure("logo sprite alpha", [&] {
+        alpha.Draw(pb, p);
+        pb.EndFrame();
+        Escape(pb.buffer);
+    });
+}
+
+// Starfield as it was before: an array of structs, each moved and drawn on
+// its own and respawned using std::mt19937 distributions
+struct StarfieldPerStar {
+    struct Star {
+        Point position;
+        int intensity{};
+    };
+    const Rectangle rect;
+    std::vector<Star> stars;
+    std::uniform_int_distribution<int> x_dist{0, 20};
+    std::uniform_int_distribution<int> y_dist;
+    std::uniform_int_distribution<int> intensity_dist{1, 10};
+
+    StarfieldPerStar(std::mt19937& rng, const Rectangle& r, int count)
+        : rect(r), stars(count), y_dist(0, r.size.height)
+    {
+        for (auto& star : stars)
+            Reset(rng, star);
+    }
+
+    void Reset(std::mt19937& rng, Star& s)
+    {
+        s.position.x = rect.point.x + rect.size.width + x_dist(rng);
+        s.position.y = rect.point.y + y_dist(rng);
+        s.intensity = intensity_dist(rng);
+    }
+
+    void Update(std::mt19937& rng, PixelBuffer& pb)
+    {
+        for (auto& star : stars) {
+            pb.PutPixel(star.position, Blend(Colour{0, 0, 0}, Colour{255, 255, 255}, static_cast<float>(star.intensity - 1) / 9.0f));
+            star.position.x -= star.intensity;
+            if (star.position.x < 0)
+                Reset(rng, star);
+        }
+    }
+};
+
+void BenchStarfield()
+{
+    for (const auto count : { 100, 1000, 10000 }) {
+        PixelBuffer pb(Size{320, 240});
+        const auto suffix = " " + std::to_string(count);
+
+        std::mt19937 rng{1};
+        StarfieldPerStar old_stars(rng, {{}, pb.GetSize()}, count);
+        Measure("starfield per-star" + suffix, [&] {
+            pb.Clear({0, 0, 0});
+            old_stars.Update(rng, pb);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        });
+
+        effects::Starfield stars({{}, pb.GetSize()}, 1, count);
+        Measure("starfield layers" + suffix, [&] {
+            pb.Clear({0, 0, 0});
+            stars.Update(pb);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        });
+        Measure("starfield layers advance only" + suffix, [&] {
+            stars.Advance();
+        });
+        Measure("starfield layers draw only" + suffix, [&] {
+            stars.Draw(pb);
+            pb.damage.Reset();
+            Escape(pb.buffer);
+        });
+    }
+}
+
+// The layers of main.cpp, with a fixed seed
+struct Scene {
+    font::Font main_font{util::ReadFile("../data/Roboto-Regular.ttf"), 70};
+    font::Font thin_font{util::ReadFile("../data/Roboto-Thin.ttf"), 20};
+    const sprite::Sprite logo{image::Decode(util::ReadFile("../data/logo.png")), 0xffffffff};
+    effects::Scroller main_scroller{main_font};
+    effects::Scroller thin_scroller{thin_font};
+    effects::Copper copper;
+    effects::Starfield starfield;
+    compositor::Compositor layers;
+
+    explicit Scene(PixelBuffer& pb)
+        : copper(pb.GetSize().height), starfield({{}, pb.GetSize()}, 1), layers(pb, {0, 0, 0})
+    {
+        main_scroller.direction = effects::ScrollDirection::RightToLeft;
+        main_scroller.speed = 2;
+        main_scroller.SetText("Daft Punk / Discovery / One More Time (Radio Edit)");
+        thin_scroller.direction = effects::ScrollDirection::LeftToRight;
+        thin_scroller.SetText("Previous track: Air / Moon Safari / La femme d'argent");
+        copper.Add({ 20, {0, 0, 0}, {255, 0, 0}, 70, 40, 160, 0 });
+        copper.Add({ 20, {0, 0, 0}, {0, 255, 0}, 70, 40, 160, 20 });
+        copper.Add({ 20, {0, 0, 0}, {0, 0, 255}, 70, 40, 160, 40 });
+
+        const auto width = pb.GetSize().width, height = pb.GetSize().height;
+        const Point logo_position{(width - logo.GetSize().width) / 2, 40 + logo.GetSize().height / 2};
+        layers.Add({ "logo", true, true, [this, logo_position](PixelBuffer& pb) { logo.Draw(pb, logo_position); } });
+        layers.Add({ "stars", false, true, [&](PixelBuffer& pb) { starfield.Draw(pb); }, [&] { starfield.Advance(); } });
+        layers.Add({ "bars", false, true,
+            [&](PixelBuffer& pb) { copper.Draw(pb); }, [&] { copper.Advance(); } });
+        layers.Add({ "current", false, true,
+            [&](PixelBuffer& pb) { main_scroller.Draw(pb, {255, 255, 255}, 130); },
+            [this, width] { main_scroller.Advance(width); } });
+        layers.Add({ "previous", false, true,
+            [this, height](PixelBuffer& pb) { thin_scroller.Draw(pb, {255, 255, 255}, height - 20); },
+            [this, width] { thin_scroller.Advance(width); } });
+    }
+};
+
+void BenchBands()
+{
+    for (const auto size : { Size{320, 240}, Size{1920, 1080} }) {
+        for (int threads = 1; threads <= 4; ++threads) {
+            PixelBuffer pb(size);
+            Scene scene(pb);
+            bands::BandedRenderer renderer(pb, threads, threads);
+            const std::function<void(PixelBuffer&)> draw = [&](PixelBuffer& band) { scene.layers.Draw(band); };
+            const auto name = "scene " + std::to_string(size.width) + "x" + std::to_string(size.height) + " " +
+                std::to_string(renderer.GetThreadCount()) + " thread(s)";
+            Measure(name, [&] {
+                scene.layers.Advance();
+                renderer.Render(draw);
+                pb.EndFrame();
+                Escape(pb.buffer);
+            });
+        }
+    }
+}
+
+// The scene drawn straight into a page, reading back whatever it blends
+// with, against drawing it into a buffer and copying the changes to a
+// memory framebuffer. Both pages are in cached memory here, so this is the
+// most in-place rendering can gain; reading back from an uncached
+// framebuffer costs more than this saves
+void BenchInPlace()
+{
+    for (const auto size : { Size{320, 240}, Size{1920, 1080} }) {
+        const auto suffix = " " + std::to_string(size.width) + "x" + std::to_string(size.height);
+        {
+            std::vector<PixelValue> page(size.width * size.height);
+            PixelBuffer pb(size, page.data());
+            Scene scene(pb);
+            Measure("in-place scene" + suffix, [&] {
+                scene.layers.Render();
+                pb.EndFrame();
+                Escape(pb.buffer);
+            });
+        }
+        FrameBufferOptions options;
+        options.backend = Backend::Memory;
+        options.size = size;
+        FrameBuffer fb(options);
+        auto& pb = fb.GetPixelBuffer();
+        Scene scene(pb);
+        Measure("in-place copy" + suffix, [&] {
+            scene.layers.Render();
+            fb.Render(pb);
+        });
+    }
+}
+
+// The scene rendered at a lower resolution and presented to a 1080p memory
+// framebuffer, against rendering it at full size
+void BenchUpscale()
+{
+    struct Config {
+        Size render_size;
+        scale::Filter filter;
+        const char* name;
+    };
+    for (const auto& config : {
+        Config{{}, scale::Filter::Nearest, "native"},
+        Config{{960, 540}, scale::Filter::Nearest, "nearest"},
+        Config{{480, 270}, scale::Filter::Nearest, "nearest"},
+        Config{{480, 270}, scale::Filter::Bilinear, "bilinear"},
+        Config{{320, 240}, scale::Filter::Nearest, "nearest"},
+    }) {
+        FrameBufferOptions options;
+        options.backend = Backend::Memory;
+        options.size = Size{1920, 1080};
+        options.render_size = config.render_size;
+        options.filter = config.filter;
+        FrameBuffer fb(options);
+        auto& pb = fb.GetPixelBuffer();
+        Scene scene(pb);
+        const auto name = std::string("upscale scene ") + std::to_string(pb.GetSize().width) + "x" +
+            std::to_string(pb.GetSize().height) + " " + config.name;
+        Measure(name, [&] {
+            scene.layers.Render();
+            fb.Render(pb);
+        });
+        // Only the scaling itself, for all of the frame
+        Measure(name + " present", [&] {
+            pb.Invalidate();
+            fb.Render(pb);
+        });
+    }
+}
+
+// Full frames presented through a memory framebuffer at each rotation
+void BenchRotate()
+{
+    for (const auto size : { Size{320, 240}, Size{1920, 1080} }) {
+        // Rotating by 90 degrees a pixel at a time, as fbcp-ili9341 would
+        const auto frame = MakeTestFrame(Size{size.height, size.width});
+        std::vector<PixelValue> rotated(size.width * size.height);
+        Measure("rotate 90 per-pixel " + std::to_string(size.width) + "x" + std::to_string(size.height), [&] {
+            for (int y = 0; y < size.width; ++y) {
+                for (int x = 0; x < size.height; ++x)
+                    rotated[x * size.width + size.width - 1 - y] = frame.buffer[y * size.height + x];
+            }
+            Escape(rotated.data());
+        });
+
+        for (const auto bpp : { 32, 16 }) {
+            for (const auto& [rotation, degrees] : {
+                std::pair{rotate::Rotation::None, 0}, {rotate::Rotation::Degrees90, 90},
+                {rotate::Rotation::Degrees180, 180}, {rotate::Rotation::Degrees270, 270} }) {
+                FrameBufferOptions options;
+                options.backend = Backend::Memory;
+                options.size = size;
+                options.bits_per_pixel = bpp;
+                options.rotation = rotation;
+                FrameBuffer fb(options);
+                auto& pb = fb.GetPixelBuffer();
+                const auto frame = MakeTestFrame(pb.GetSize());
+                std::memcpy(pb.buffer, frame.buffer, pb.GetSize().width * pb.GetSize().height * sizeof(PixelValue));
+                Measure("rotate " + std::to_string(degrees) + " " + std::to_string(bpp) + "bpp " +
+                    std::to_string(size.width) + "x" + std::to_string(size.height), [&] {
+                    pb.Invalidate();
+                    fb.Render(pb);
+                });
+            }
+        }
+    }
+}
+
+// Scene as partyplayer --indexed draws it, with palette indices: black,
+// then the stars, the copper bars, the shades of the text and a colour cube
+// for the logo. It looks close to Scene, but not the same: text is
+// anti-aliased against black instead of blended and the logo has only the
+// colours of the cube
+struct IndexedScene {
+    static constexpr inline std::uint8_t StarColours = 1;
+    static constexpr inline std::uint8_t CopperColours = StarColours + effects::Starfield::DefaultLayers;
+    static constexpr inline std::uint8_t TextColours = 80;
+    static constexpr inline int TextLevels = 8;
+    static constexpr inline std::uint8_t LogoColours = TextColours + TextLevels;
+    static constexpr inline int CubeLevels = 5;
+
+    font::Font main_font{util::ReadFile("../data/Roboto-Regular.ttf"), 70};
+    font::Font thin_font{util::ReadFile("../data/Roboto-Thin.ttf"), 20};
+    effects::Scroller main_scroller{main_font};
+    effects::Scroller thin_scroller{thin_font};
+    effects::Copper copper;
+    effects::Starfield starfield;
+    Size logo_size;
+    Point logo_position;
+    // Index 0 is transparent
+    std::vector<std::uint8_t> logo;
+
+    explicit IndexedScene(IndexedPixelBuffer& ib)
+        : copper(ib.GetSize().height), starfield({{}, ib.GetSize()}, 1)
+    {
+        main_scroller.direction = effects::ScrollDirection::RightToLeft;
+        main_scroller.speed = 2;
+        main_scroller.SetText("Daft Punk / Discovery / One More Time (Radio Edit)");
+        thin_scroller.direction = effects::ScrollDirection::LeftToRight;
+        thin_scroller.SetText("Previous track: Air / Moon Safari / La femme d'argent");
+        copper.Add({ 20, {0, 0, 0}, {255, 0, 0}, 70, 40, 160, 0 });
+        copper.Add({ 20, {0, 0, 0}, {0, 255, 0}, 70, 40, 160, 20 });
+        copper.Add({ 20, {0, 0, 0}, {0, 0, 255}, 70, 40, 160, 40 });
+
+        ib.SetColour(0, {0, 0, 0});
+        starfield.SetPalette(ib, StarColours);
+        copper.SetPalette(ib, CopperColours);
+        ib.SetGradient(TextColours, TextLevels, {0, 0, 0}, {255, 255, 255});
+        ib.SetColourCube(LogoColours, CubeLevels);
+
+        // The same white key as the sprite of Scene
+        const auto image = image::Decode(util::ReadFile("../data/logo.png"));
+        logo_size = image.GetSize();
+        logo = indexed::Quantize(image, LogoColours, CubeLevels, 0xffffffff, 0);
+        logo_position = {(ib.GetSize().width - logo_size.width) / 2, 40 + logo_size.height / 2};
+    }
+
+    void Render(IndexedPixelBuffer& ib)
+    {
+        ib.Clear(0);
+        ib.Blit(logo_position, logo_size, logo.data(), logo_size.width, 0);
+        starfield.Draw(ib, StarColours);
+        copper.Draw(ib, CopperColours);
+        main_scroller.Draw(ib, TextColours, TextLevels, 130);
+        thin_scroller.Draw(ib, TextColours, TextLevels, ib.GetSize().height - 20);
+        starfield.Advance();
+        copper.Advance();
+        main_scroller.Advance(ib.GetSize().width);
+        thin_scroller.Advance(ib.GetSize().width);
+    }
+};
+
+// The scene of main.cpp in direct colour and as drawn with --indexed,
+// presented to a memory framebuffer
+void BenchIndexed()
+{
+    for (const auto size : { Size{320, 240}, Size{1920, 1080} }) {
+        for (const auto bpp : { 32, 16 }) {
+            FrameBufferOptions options;
+            options.backend = Backend::Memory;
+            options.size = size;
+            options.bits_per_pixel = bpp;
+            const auto suffix = " " + std::to_string(bpp) + "bpp " + std::to_string(size.width) + "x" + std::to_string(size.height);
+            {
+                FrameBuffer fb(options);
+                auto& pb = fb.GetPixelBuffer();
+                Scene scene(pb);
+                Measure("indexed scene direct" + suffix, [&] {
+                    scene.layers.Render();
+                    fb.Render(pb);
+                });
+            }
+
+            FrameBuffer fb(options);
+            IndexedPixelBuffer ib(size);
+            IndexedScene scene(ib);
+            Measure("indexed scene indexed" + suffix, [&] {
+                scene.Render(ib);
+                fb.Render(ib);
+            });
+            // Nothing is drawn, but all of the frame is looked up again
+            Measure("indexed palette cycle" + suffix, [&] {
+                ib.CyclePalette(IndexedScene::CopperColours, scene.copper.GetColourCount());
+                fb.Render(ib);
+            });
+        }
+
+        // The lookup itself, against a plain loop
+        std::vector<std::uint8_t> indices(size.width * size.height);
+        for (size_t n = 0; n < indices.size(); ++n)
+            indices[n] = static_cast<std::uint8_t>(n * 7);
+        Palette palette;
+        for (size_t n = 0; n < palette.size(); ++n)
+            palette[n] = static_cast<PixelValue>(n * 0x010203);
+        std::vector<PixelValue> pixels(indices.size());
+        const auto suffix = " " + std::to_string(size.width) + "x" + std::to_string(size.height);
+        Measure("indexed expand per-pixel" + suffix, [&] {
+            for (size_t n = 0; n < indices.size(); ++n)
+                pixels[n] = palette[indices[n]];
+            Escape(pixels.data());
+        });
+        Measure("indexed expand" + suffix, [&] {
+            indexed::Expand(pixels.data(), indices.data(), palette.data(), static_cast<int>(indices.size()));
+            Escape(pixels.data());
+        });
+    }
+}
+
+// The table driven effects, filling the whole frame. On the Pi 3 driving
+// the 320x240 display, each must fit in a quarter of a 60 Hz frame to leave
+// room for the rest of the scene and for presenting; elsewhere this is only
+// a rough guide
+void BenchDemo()
+{
+    constexpr double budget = 1e6 / 60 / 4;
+    const Size display{320, 240};
+    for (const auto size : { display, Size{1920, 1080} }) {
+        PixelBuffer pb(size);
+        const Rectangle screen{{}, size};
+        const auto suffix = " " + std::to_string(size.width) + "x" + std::to_string(size.height);
+        const auto check = [&](std::string_view name, double us) {
+            if (size != display || us <= budget)
+                return;
+            std::printf("%-48s over budget of %.2f us\n", std::string(name).c_str(), budget);
+            failed = true;
+        };
+
+        // Plasma as it is often written, with the sines taken per pixel
+        int time = 0;
+        Measure("demo plasma per-pixel sin" + suffix, [&] {
+            ++time;
+            for (int y = 0; y < size.height; ++y) {
+                for (int x = 0; x < size.width; ++x) {
+                    const auto v = std::sin(x * 0.05 + time * 0.07) + std::sin(y * 0.04 + time * 0.05) + std::sin((x + y) * 0.03);
+                    const auto i = static_cast<int>(v * 42 + 128);
+                    pb.buffer[y * size.width + x] = Colour{i, 255 - i, 128};
+                }
+            }
+            Escape(pb.buffer);
+        });
+
+        effects::Plasma plasma(screen);
+        check("plasma", Measure("demo plasma" + suffix, [&] {
+            plasma.Update(pb);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        }));
+        effects::Rotozoom rotozoom(screen);
+        check("rotozoom", Measure("demo rotozoom" + suffix, [&] {
+            rotozoom.Update(pb);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        }));
+        effects::Tunnel tunnel(screen);
+        check("tunnel", Measure("demo tunnel" + suffix, [&] {
+            tunnel.Update(pb);
+            pb.EndFrame();
+            Escape(pb.buffer);
+        }));
+    }
+}
+
+struct Benchmark {
+    std::string_view name;
+    void (*fn)();
+};
+
+constexpr std::array benchmarks{
+    Benchmark{"present", BenchPresent},
+    Benchmark{"copperbar", BenchCopperbar},
+    Benchmark{"blend", BenchBlend},
+    Benchmark{"scroller", BenchScroller},
+    Benchmark{"text", BenchText},
+    Benchmark{"sdf", BenchSdf},
+    Benchmark{"logo", BenchLogo},
+    Benchmark{"starfield", BenchStarfield},
+    Benchmark{"bands", BenchBands},
+    Benchmark{"inplace", BenchInPlace},
+    Benchmark{"upscale", BenchUpscale},
+    Benchmark{"rotate", BenchRotate},
+    Benchmark{"indexed", BenchIndexed},
+    Benchmark{"demo", BenchDemo},
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+    // Optional argument selects benchmarks by name
+    const std::string_view filter = argc > 1 ? argv[1] : "";
+    for (const auto& b : benchmarks) {
+        if (b.name.find(filter) == std::string_view::npos)
+            continue;
+        b.fn();
+    }
+    return failed ? 1 : 0;
+}
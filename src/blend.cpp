@@ -0,0 +1,231 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "blend.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// All kernels compute round((d * (255 - a) + c * a) / 255) per channel as
+// (t + (t >> 8)) >> 8 with t = d * (255 - a) + c * a + 128, which is exact
+// and identical to BlendPixel()
+
+namespace blend {
+
+namespace {
+
+#if defined(__SSE2__) && !defined(__ARM_NEON)
+// Blends 16-bit channels of two pixels with weights given per channel
+inline __m128i Blend16(__m128i d, __m128i c, __m128i a)
+{
+    const auto inverse = _mm_sub_epi16(_mm_set1_epi16(255), a);
+    auto t = _mm_add_epi16(_mm_mullo_epi16(d, inverse), _mm_mullo_epi16(c, a));
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+#endif
+
+#if defined(__AVX2__) && !defined(__ARM_NEON)
+inline __m256i Blend16(__m256i d, __m256i c, __m256i a)
+{
+    const auto inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+    auto t = _mm256_add_epi16(_mm256_mullo_epi16(d, inverse), _mm256_mullo_epi16(c, a));
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+#endif
+
+}
+
+void Mask(PixelValue* dest, const uint8_t* mask, PixelValue colour, int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    // De-interleave 8 pixels into channel planes so each channel is 8 lanes
+    const auto c = vld4_dup_u8(reinterpret_cast<const uint8_t*>(&colour));
+    for (; n + 8 <= count; n += 8) {
+        uint64_t alpha8;
+        memcpy(&alpha8, mask + n, 8);
+        if (alpha8 == 0)
+            continue;
+        if (alpha8 == ~uint64_t{0}) {
+            const auto v = vdupq_n_u32(colour);
+            vst1q_u32(dest + n, v);
+            vst1q_u32(dest + n + 4, v);
+            continue;
+        }
+        const auto a = vld1_u8(mask + n);
+        auto d = vld4_u8(reinterpret_cast<uint8_t*>(dest + n));
+        const auto inverse = vmvn_u8(a);
+        for (int ch = 0; ch < 4; ++ch) {
+            auto t = vmull_u8(d.val[ch], inverse);
+            t = vmlal_u8(t, c.val[ch], a);
+            d.val[ch] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+        }
+        vst4_u8(reinterpret_cast<uint8_t*>(dest + n), d);
+    }
+#elif defined(__AVX2__)
+    const auto zero = _mm256_setzero_si256();
+    const auto c = _mm256_unpacklo_epi8(_mm256_set1_epi32(static_cast<int>(colour)), zero);
+    // Replicates each pixel's alpha byte over its four 16-bit channels
+    const auto spread = _mm256_setr_epi8(
+        0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1, 1, -1,
+        0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1, 1, -1);
+    for (; n + 8 <= count; n += 8) {
+        uint32_t alpha4[2];
+        memcpy(alpha4, mask + n, 8);
+        if ((alpha4[0] | alpha4[1]) == 0)
+            continue;
+        if ((alpha4[0] & alpha4[1]) == 0xffffffff) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + n), _mm256_set1_epi32(static_cast<int>(colour)));
+            continue;
+        }
+        const auto p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + n));
+        // Lane i of each 128-bit half handles pixels {0,1,4,5} / {2,3,6,7}
+        // after unpacking, so the alpha bytes are arranged to match
+        const auto a = _mm256_setr_epi32(mask[n + 0] | mask[n + 1] << 8, 0, 0, 0, mask[n + 4] | mask[n + 5] << 8, 0, 0, 0);
+        const auto a_hi = _mm256_setr_epi32(mask[n + 2] | mask[n + 3] << 8, 0, 0, 0, mask[n + 6] | mask[n + 7] << 8, 0, 0, 0);
+        const auto lo = Blend16(_mm256_unpacklo_epi8(p, zero), c, _mm256_shuffle_epi8(a, spread));
+        const auto hi = Blend16(_mm256_unpackhi_epi8(p, zero), c, _mm256_shuffle_epi8(a_hi, spread));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + n), _mm256_packus_epi16(lo, hi));
+    }
+#elif defined(__SSE2__)
+    const auto zero = _mm_setzero_si128();
+    const auto c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(colour)), zero);
+    const auto c2 = _mm_unpacklo_epi64(c, c);
+    for (; n + 4 <= count; n += 4) {
+        uint32_t alpha4;
+        memcpy(&alpha4, mask + n, 4);
+        if (alpha4 == 0)
+            continue;
+        if (alpha4 == 0xffffffff) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_set1_epi32(static_cast<int>(colour)));
+            continue;
+        }
+        const auto p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n));
+        // Spread each alpha byte over the four 16-bit channels of its pixel
+        auto a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(alpha4)), zero);
+        a = _mm_unpacklo_epi16(a, a);
+        const auto a_lo = _mm_unpacklo_epi32(a, a);
+        const auto a_hi = _mm_unpackhi_epi32(a, a);
+        const auto lo = Blend16(_mm_unpacklo_epi8(p, zero), c2, a_lo);
+        const auto hi = Blend16(_mm_unpackhi_epi8(p, zero), c2, a_hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; n < count; ++n) {
+        if (mask[n] != 0)
+            dest[n] = BlendPixel(dest[n], colour, mask[n]);
+    }
+}
+
+void MaskColumn(PixelValue* dest, const std::ptrdiff_t stride, const uint8_t* mask, const PixelValue colour, const int count)
+{
+    // Pixels a column apart share no vector, but text mostly consists of
+    // pixels that are fully covered or not at all, which need no blending
+    for (int n = 0; n < count; ++n, dest += stride) {
+        if (mask[n] == 255)
+            *dest = colour;
+        else if (mask[n] != 0)
+            *dest = BlendPixel(*dest, colour, mask[n]);
+    }
+}
+
+void Alpha(PixelValue* dest, const PixelValue* source, int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    for (; n + 8 <= count; n += 8) {
+        const auto s = vld4_u8(reinterpret_cast<const uint8_t*>(source + n));
+        auto d = vld4_u8(reinterpret_cast<uint8_t*>(dest + n));
+        const auto a = s.val[3];
+        const auto inverse = vmvn_u8(a);
+        for (int ch = 0; ch < 4; ++ch) {
+            auto t = vmull_u8(d.val[ch], inverse);
+            t = vmlal_u8(t, s.val[ch], a);
+            d.val[ch] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+        }
+        vst4_u8(reinterpret_cast<uint8_t*>(dest + n), d);
+    }
+#elif defined(__AVX2__)
+    const auto zero = _mm256_setzero_si256();
+    for (; n + 8 <= count; n += 8) {
+        const auto p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + n));
+        const auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + n));
+        // Alpha is the top channel of each pixel; spread it over all four
+        const auto s_lo = _mm256_unpacklo_epi8(s, zero);
+        const auto s_hi = _mm256_unpackhi_epi8(s, zero);
+        const auto a_lo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_lo, 0xff), 0xff);
+        const auto a_hi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_hi, 0xff), 0xff);
+        const auto lo = Blend16(_mm256_unpacklo_epi8(p, zero), s_lo, a_lo);
+        const auto hi = Blend16(_mm256_unpackhi_epi8(p, zero), s_hi, a_hi);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + n), _mm256_packus_epi16(lo, hi));
+    }
+#elif defined(__SSE2__)
+    const auto zero = _mm_setzero_si128();
+    for (; n + 4 <= count; n += 4) {
+        const auto p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n));
+        const auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n));
+        // Alpha is the top channel of each pixel; spread it over all four
+        const auto s_lo = _mm_unpacklo_epi8(s, zero);
+        const auto s_hi = _mm_unpackhi_epi8(s, zero);
+        const auto a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, 0xff), 0xff);
+        const auto a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, 0xff), 0xff);
+        const auto lo = Blend16(_mm_unpacklo_epi8(p, zero), s_lo, a_lo);
+        const auto hi = Blend16(_mm_unpackhi_epi8(p, zero), s_hi, a_hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; n < count; ++n)
+        dest[n] = BlendPixel(dest[n], source[n], source[n] >> 24);
+}
+
+void DistanceToCoverage(uint8_t* dest, const uint8_t* distance, int gain, int count)
+{
+    // Distances beyond the limit saturate anyway; clamping them first keeps
+    // the product within 16 bits
+    const auto limit = std::min((128 << 6) / gain + 1, 128);
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto g = vdupq_n_s16(gain);
+    const auto low = vdupq_n_s16(-limit), high = vdupq_n_s16(limit);
+    const auto bias = vdupq_n_s16(128);
+    for (; n + 8 <= count; n += 8) {
+        auto d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(distance + n))), bias);
+        d = vminq_s16(vmaxq_s16(d, low), high);
+        const auto c = vaddq_s16(vshrq_n_s16(vmulq_s16(d, g), 6), bias);
+        vst1_u8(dest + n, vqmovun_s16(c));
+    }
+#elif defined(__SSE2__)
+    const auto g = _mm_set1_epi16(gain);
+    const auto low = _mm_set1_epi16(-limit), high = _mm_set1_epi16(limit);
+    const auto bias = _mm_set1_epi16(128);
+    const auto zero = _mm_setzero_si128();
+    for (; n + 16 <= count; n += 16) {
+        const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(distance + n));
+        auto lo = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), bias);
+        auto hi = _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), bias);
+        lo = _mm_min_epi16(_mm_max_epi16(lo, low), high);
+        hi = _mm_min_epi16(_mm_max_epi16(hi, low), high);
+        lo = _mm_add_epi16(_mm_srai_epi16(_mm_mullo_epi16(lo, g), 6), bias);
+        hi = _mm_add_epi16(_mm_srai_epi16(_mm_mullo_epi16(hi, g), 6), bias);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; n < count; ++n) {
+        const auto d = std::clamp(distance[n] - 128, -limit, limit);
+        dest[n] = std::clamp(128 + ((d * gain) >> 6), 0, 255);
+    }
+}
+
+}
@@ -0,0 +1,29 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "types.h"
+
+namespace blend {
+
+// dest[n] = BlendPixel(dest[n], colour, mask[n]) for a row of pixels
+void Mask(PixelValue* dest, const uint8_t* mask, PixelValue colour, int count);
+
+// As Mask(), for a column of pixels that are stride pixels apart
+void MaskColumn(PixelValue* dest, std::ptrdiff_t stride, const uint8_t* mask, PixelValue colour, int count);
+
+// dest[n] = BlendPixel(dest[n], source[n], source[n] >> 24) for a row of pixels
+void Alpha(PixelValue* dest, const PixelValue* source, int count);
+
+// Turns a row of distance field samples into coverage:
+// dest[n] = clamp(128 + ((distance[n] - 128) * gain >> 6), 0, 255)
+// gain is fixed point with 6 fractional bits and must be positive
+void DistanceToCoverage(uint8_t* dest, const uint8_t* distance, int gain, int count);
+
+}
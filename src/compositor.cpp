@@ -0,0 +1,78 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "compositor.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace compositor {
+
+Compositor::Compositor(PixelBuffer& pb, const Colour& clear_colour)
+    : pb(pb), clear_colour(clear_colour), background(pb.GetSize())
+{
+}
+
+void Compositor::Add(Layer layer)
+{
+    layers.push_back(std::move(layer));
+    Invalidate();
+}
+
+void Compositor::SetOrder(const std::vector<std::string_view>& names)
+{
+    std::vector<Layer> ordered;
+    for (const auto name : names) {
+        auto it = std::find_if(layers.begin(), layers.end(), [&](const auto& l) { return l.name == name; });
+        if (it == layers.end())
+            throw std::runtime_error("unknown layer '" + std::string(name) + "'");
+        ordered.push_back(std::move(*it));
+        ordered.back().visible = true;
+        layers.erase(it);
+    }
+    for (auto& layer : layers) {
+        layer.visible = false;
+        ordered.push_back(std::move(layer));
+    }
+    layers = std::move(ordered);
+    Invalidate();
+}
+
+void Compositor::RenderBackground()
+{
+    first_dynamic = 0;
+    while (first_dynamic < layers.size() && (layers[first_dynamic].is_static || !layers[first_dynamic].visible))
+        ++first_dynamic;
+
+    background.FilledRectangle({{}, background.GetSize()}, clear_colour);
+    for (size_t n = 0; n < first_dynamic; ++n) {
+        if (layers[n].visible)
+            layers[n].draw(background);
+    }
+    background_valid = true;
+    // Whatever pb holds is based on the old background
+    pb.Invalidate();
+}
+
+void Compositor::Advance()
+{
+    for (auto& layer : layers) {
+        if (layer.visible && layer.advance)
+            layer.advance();
+    }
+    if (!background_valid)
+        RenderBackground();
+}
+
+void Compositor::Draw(PixelBuffer& target) const
+{
+    target.Restore(background);
+    for (size_t n = first_dynamic; n < layers.size(); ++n) {
+        if (layers[n].visible)
+            layers[n].draw(target);
+    }
+}
+
+}
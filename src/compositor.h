@@ -0,0 +1,67 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "pixelbuffer.h"
+#include "types.h"
+
+namespace compositor {
+
+struct Layer {
+    std::string name;
+    // Static layers look the same every frame
+    bool is_static{};
+    bool visible{true};
+    // Must not change any state, as it may be called for several parts of
+    // the buffer at once
+    std::function<void(PixelBuffer&)> draw;
+    // Moves the layer to its next frame, if it moves at all
+    std::function<void()> advance;
+};
+
+// Draws layers from bottom to top. Static layers below all visible dynamic
+// ones are drawn once into a background, which replaces clearing the buffer;
+// static layers above a dynamic one are drawn every frame
+class Compositor {
+    PixelBuffer& pb;
+    const Colour clear_colour;
+    std::vector<Layer> layers;
+    PixelBuffer background;
+    // Layers before this one are in the background
+    size_t first_dynamic{};
+    bool background_valid{};
+
+    void RenderBackground();
+
+public:
+    Compositor(PixelBuffer& pb, const Colour& clear_colour);
+
+    // Adds a layer on top of all others
+    void Add(Layer layer);
+    // Shows the named layers in the given order, bottom first, and hides the
+    // others; throws if a name is unknown
+    void SetOrder(const std::vector<std::string_view>& names);
+    // Call if a static layer would draw differently from now on
+    void Invalidate() { background_valid = false; }
+
+    // Advances all visible layers and renders the background if needed
+    void Advance();
+    // Restores the background and draws the other layers to target, which
+    // is the buffer passed on construction or a view of it
+    void Draw(PixelBuffer& target) const;
+    void Render()
+    {
+        Advance();
+        Draw(pb);
+    }
+};
+
+}
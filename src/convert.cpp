@@ -0,0 +1,118 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "convert.h"
+#include <array>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace convert {
+
+namespace {
+
+constexpr std::array<std::array<uint8_t, 4>, 4> bayer{{
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+}};
+
+// Per-pixel amount to add to each channel before truncating it to 5/6/5
+// bits; this is scaled from the 0..15 threshold to the bits being lost
+constexpr PixelValue DitherOffset(int x, int y)
+{
+    const PixelValue t = bayer[y & 3][x & 3];
+    return (t >> 1) | (t >> 2) << 8 | (t >> 1) << 16;
+}
+
+// Pixels are taken as the 32bpp framebuffer shows them: blue in the lowest byte
+inline uint16_t Pack(PixelValue p, const RGB565Layout& layout)
+{
+    const auto b = (p >> 3) & 0x1f;
+    const auto g = (p >> 10) & 0x3f;
+    const auto r = (p >> 19) & 0x1f;
+    return static_cast<uint16_t>(r << layout.red_shift | g << 5 | b << layout.blue_shift);
+}
+
+inline PixelValue AddSaturated(PixelValue p, PixelValue offset)
+{
+    PixelValue result{};
+    for (int shift = 0; shift < 32; shift += 8) {
+        const auto v = std::min<PixelValue>(((p >> shift) & 0xff) + ((offset >> shift) & 0xff), 0xff);
+        result |= v << shift;
+    }
+    return result;
+}
+
+// Converts groups of 8 pixels; returns the number of pixels done. If dither
+// is set, it holds the offsets for the first 4 pixels (the pattern repeats
+// every 4 pixels)
+int ConvertVector(uint16_t* dest, const PixelValue* source, int count, const RGB565Layout& layout, const PixelValue* dither)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto mask5 = vdupq_n_u32(0x1f);
+    const auto mask6 = vdupq_n_u32(0x3f);
+    const auto red_shift = vdupq_n_s32(layout.red_shift);
+    const auto blue_shift = vdupq_n_s32(layout.blue_shift);
+    const auto offset = dither ? vreinterpretq_u8_u32(vld1q_u32(dither)) : vdupq_n_u8(0);
+    for (; n + 8 <= count; n += 8) {
+        for (int half = 0; half < 8; half += 4) {
+            auto p = vld1q_u32(source + n + half);
+            p = vreinterpretq_u32_u8(vqaddq_u8(vreinterpretq_u8_u32(p), offset));
+            const auto b = vandq_u32(vshrq_n_u32(p, 3), mask5);
+            const auto g = vandq_u32(vshrq_n_u32(p, 10), mask6);
+            const auto r = vandq_u32(vshrq_n_u32(p, 19), mask5);
+            const auto v = vorrq_u32(vorrq_u32(vshlq_u32(r, red_shift), vshlq_n_u32(g, 5)), vshlq_u32(b, blue_shift));
+            vst1_u16(dest + n + half, vmovn_u32(v));
+        }
+    }
+#elif defined(__SSE2__)
+    const auto mask5 = _mm_set1_epi32(0x1f);
+    const auto mask6 = _mm_set1_epi32(0x3f);
+    const auto red_shift = _mm_cvtsi32_si128(layout.red_shift);
+    const auto blue_shift = _mm_cvtsi32_si128(layout.blue_shift);
+    const auto offset = dither ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither)) : _mm_setzero_si128();
+    const auto convert = [&](__m128i p) {
+        p = _mm_adds_epu8(p, offset);
+        const auto b = _mm_and_si128(_mm_srli_epi32(p, 3), mask5);
+        const auto g = _mm_and_si128(_mm_srli_epi32(p, 10), mask6);
+        const auto r = _mm_and_si128(_mm_srli_epi32(p, 19), mask5);
+        const auto v = _mm_or_si128(_mm_or_si128(_mm_sll_epi32(r, red_shift), _mm_slli_epi32(g, 5)), _mm_sll_epi32(b, blue_shift));
+        // Sign-extend so that the signed saturation of the pack leaves it be
+        return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+    };
+    for (; n + 8 <= count; n += 8) {
+        const auto lo = convert(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n)));
+        const auto hi = convert(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n + 4)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    return n;
+}
+
+}
+
+void ToRGB565(uint16_t* dest, const PixelValue* source, int count, const RGB565Layout& layout)
+{
+    for (int n = ConvertVector(dest, source, count, layout, nullptr); n < count; ++n)
+        dest[n] = Pack(source[n], layout);
+}
+
+void ToRGB565Dithered(uint16_t* dest, const PixelValue* source, int count, int x, int y, const RGB565Layout& layout)
+{
+    const std::array<PixelValue, 4> offsets{
+        DitherOffset(x + 0, y), DitherOffset(x + 1, y), DitherOffset(x + 2, y), DitherOffset(x + 3, y),
+    };
+    for (int n = ConvertVector(dest, source, count, layout, offsets.data()); n < count; ++n)
+        dest[n] = Pack(AddSaturated(source[n], offsets[n & 3]), layout);
+}
+
+}
@@ -0,0 +1,29 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <cstdint>
+#include "types.h"
+
+namespace convert {
+
+// Bit positions of the red and blue fields within a 16bpp pixel; green is
+// always located at bit 5
+struct RGB565Layout {
+    int red_shift{11};
+    int blue_shift{0};
+};
+
+// Source pixels are taken as the 32bpp framebuffer shows them: blue in the
+// lowest byte, then green and red
+void ToRGB565(uint16_t* dest, const PixelValue* source, int count, const RGB565Layout& layout);
+
+// As ToRGB565(), but using 4x4 ordered dithering; x and y are the screen
+// position of the first pixel
+void ToRGB565Dithered(uint16_t* dest, const PixelValue* source, int count, int x, int y, const RGB565Layout& layout);
+
+}
@@ -0,0 +1,646 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "effects.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <climits>
+#include <stdexcept>
+#include "blend.h"
+#include "font.h"
+#include "indexed.h"
+#include "pixelbuffer.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace effects {
+
+namespace {
+
+// Sine over a full period of 1 << SineBits steps, where 1 << SineShift is one
+constexpr inline int SineBits = 10;
+constexpr inline int SineShift = 14;
+
+const std::array<std::int32_t, 1 << SineBits>& SineTable()
+{
+    static const auto table = [] {
+        std::array<std::int32_t, 1 << SineBits> t;
+        for (size_t n = 0; n < t.size(); ++n)
+            t[n] = static_cast<std::int32_t>(std::lround(std::sin(2 * M_PI * n / t.size()) * (1 << SineShift)));
+        return t;
+    }();
+    return table;
+}
+
+// Sine over a period of 256 steps, from 1 to 255
+const std::array<std::uint8_t, 256>& ByteSineTable()
+{
+    static const auto table = [] {
+        std::array<std::uint8_t, 256> t;
+        const auto& sine = SineTable();
+        for (size_t n = 0; n < t.size(); ++n)
+            t[n] = static_cast<std::uint8_t>(128 + (sine[n * sine.size() / t.size()] * 127 >> SineShift));
+        return t;
+    }();
+    return table;
+}
+
+// 256x256 pixels, indexed by v << 8 | u so that coordinates wrap around
+const std::vector<PixelValue>& Texture()
+{
+    static const auto texture = [] {
+        std::vector<PixelValue> t(256 * 256);
+        for (int v = 0; v < 256; ++v) {
+            for (int u = 0; u < 256; ++u) {
+                const auto x = u ^ v;
+                const auto grid = (u & 31) == 0 || (v & 31) == 0;
+                t[v << 8 | u] = grid ? Colour{255, 255, 255} : Colour{x / 2, x, 255 - x / 2};
+            }
+        }
+        return t;
+    }();
+    return texture;
+}
+
+// Rows are done in parts of at most this many pixels, so that their indices
+// fit on the stack
+constexpr inline int ChunkSize = 256;
+
+// dest[n] = a[n] + b[n] + c, wrapping around
+void AddBytes(std::uint8_t* dest, const std::uint8_t* a, const std::uint8_t* b, const std::uint8_t c, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto vc = vdupq_n_u8(c);
+    for (; n + 16 <= count; n += 16)
+        vst1q_u8(dest + n, vaddq_u8(vaddq_u8(vld1q_u8(a + n), vld1q_u8(b + n)), vc));
+#elif defined(__SSE2__)
+    const auto vc = _mm_set1_epi8(static_cast<char>(c));
+    for (; n + 16 <= count; n += 16) {
+        const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + n));
+        const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + n));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_add_epi8(_mm_add_epi8(va, vb), vc));
+    }
+#endif
+    for (; n < count; ++n)
+        dest[n] = static_cast<std::uint8_t>(a[n] + b[n] + c);
+}
+
+// Both bytes of dest[n] are those of source[n] plus those of offset,
+// wrapping around without carrying
+void AddBytePairs(std::uint16_t* dest, const std::uint16_t* source, const std::uint16_t offset, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto vo = vreinterpretq_u8_u16(vdupq_n_u16(offset));
+    for (; n + 8 <= count; n += 8)
+        vst1q_u16(dest + n, vreinterpretq_u16_u8(vaddq_u8(vreinterpretq_u8_u16(vld1q_u16(source + n)), vo)));
+#elif defined(__SSE2__)
+    const auto vo = _mm_set1_epi16(static_cast<short>(offset));
+    for (; n + 8 <= count; n += 8) {
+        const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_add_epi8(v, vo));
+    }
+#endif
+    for (; n < count; ++n)
+        dest[n] = static_cast<std::uint16_t>((((source[n] & 0xff00) + (offset & 0xff00)) & 0xff00) | ((source[n] + offset) & 0xff));
+}
+
+// Texture indices along a row starting at 16.16 coordinates (u, v), moving
+// (du, dv) per pixel
+void TextureRow(std::uint32_t* index, std::uint32_t u, std::uint32_t v, const std::uint32_t du, const std::uint32_t dv, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const uint32_t lanes[4]{0, 1, 2, 3};
+    const auto l = vld1q_u32(lanes);
+    auto vu = vmlaq_n_u32(vdupq_n_u32(u), l, du);
+    auto vv = vmlaq_n_u32(vdupq_n_u32(v), l, dv);
+    const auto su = vdupq_n_u32(4 * du);
+    const auto sv = vdupq_n_u32(4 * dv);
+    for (; n + 4 <= count; n += 4) {
+        vst1q_u32(index + n, vorrq_u32(vandq_u32(vshrq_n_u32(vv, 8), vdupq_n_u32(0xff00)), vshrq_n_u32(vshlq_n_u32(vu, 8), 24)));
+        vu = vaddq_u32(vu, su);
+        vv = vaddq_u32(vv, sv);
+    }
+#elif defined(__SSE2__)
+    const auto lanes = [](std::uint32_t x, std::uint32_t dx) {
+        return _mm_setr_epi32(static_cast<int>(x), static_cast<int>(x + dx), static_cast<int>(x + 2 * dx), static_cast<int>(x + 3 * dx));
+    };
+    auto vu = lanes(u, du);
+    auto vv = lanes(v, dv);
+    const auto su = _mm_set1_epi32(static_cast<int>(4 * du));
+    const auto sv = _mm_set1_epi32(static_cast<int>(4 * dv));
+    const auto mask = _mm_set1_epi32(0xff00);
+    for (; n + 4 <= count; n += 4) {
+        const auto i = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(vv, 8), mask), _mm_srli_epi32(_mm_slli_epi32(vu, 8), 24));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(index + n), i);
+        vu = _mm_add_epi32(vu, su);
+        vv = _mm_add_epi32(vv, sv);
+    }
+#endif
+    u += n * du;
+    v += n * dv;
+    for (; n < count; ++n) {
+        index[n] = (v >> 8 & 0xff00) | (u >> 16 & 0xff);
+        u += du;
+        v += dv;
+    }
+}
+
+// Subtracts speed from count positions; calls respawn(n) for every
+// position that ends up left of left
+template<typename Fn>
+void MoveLeft(std::int32_t* x, const int count, const std::int32_t speed, const std::int32_t left, Fn respawn)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto s = vdupq_n_s32(speed);
+    const auto l = vdupq_n_s32(left);
+    for (; n + 4 <= count; n += 4) {
+        const auto v = vsubq_s32(vld1q_s32(x + n), s);
+        vst1q_s32(x + n, v);
+        const auto gone = vmovn_u32(vcltq_s32(v, l));
+        if (vget_lane_u64(vreinterpret_u64_u16(gone), 0) == 0)
+            continue;
+        for (int k = 0; k < 4; ++k) {
+            if (x[n + k] < left)
+                respawn(n + k);
+        }
+    }
+#elif defined(__SSE2__)
+    const auto s = _mm_set1_epi32(speed);
+    const auto l = _mm_set1_epi32(left);
+    for (; n + 4 <= count; n += 4) {
+        const auto v = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + n)), s);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(x + n), v);
+        const auto gone = _mm_movemask_epi8(_mm_cmplt_epi32(v, l));
+        if (gone == 0)
+            continue;
+        for (int k = 0; k < 4; ++k) {
+            if (gone & (1 << (4 * k)))
+                respawn(n + k);
+        }
+    }
+#endif
+    for (; n < count; ++n) {
+        x[n] -= speed;
+        if (x[n] < left)
+            respawn(n);
+    }
+}
+
+// Stores value at each of count positions that lie within clip, and widens
+// rows[y - clip.point.y] to cover it
+template<typename Pixel>
+void Plot(Pixel* buffer, const int stride, const Rectangle& clip, const std::int32_t* x, const std::int32_t* y, const int count, const Pixel value, Span* rows)
+{
+    const auto width = static_cast<unsigned>(clip.size.width);
+    const auto height = static_cast<unsigned>(clip.size.height);
+    for (int n = 0; n < count; ++n) {
+        const auto column = static_cast<unsigned>(x[n] - clip.point.x);
+        const auto row = static_cast<unsigned>(y[n] - clip.point.y);
+        if (column >= width || row >= height)
+            continue;
+        buffer[y[n] * stride + x[n]] = value;
+        auto& span = rows[row];
+        span.x0 = std::min(span.x0, x[n]);
+        span.x1 = std::max(span.x1, x[n] + 1);
+    }
+}
+
+}
+
+void Scroller::SetText(std::string sv)
+{
+    text = std::move(sv);
+    width = font::GetTextWidth(font, text);
+    strip = font::RenderText(font, text);
+
+    const auto w = strip.size.width, h = strip.size.height;
+    columns.resize(w * h);
+    column_top.assign(w, 0);
+    column_bottom.assign(w, 0);
+    for (int c = 0; c < w; ++c) {
+        auto column = &columns[c * h];
+        for (int y = 0; y < h; ++y)
+            column[y] = strip.mask[y * w + c];
+        int top = 0, bottom = h;
+        while (top < bottom && column[top] == 0)
+            ++top;
+        while (bottom > top && column[bottom - 1] == 0)
+            --bottom;
+        column_top[c] = static_cast<std::uint16_t>(top);
+        column_bottom[c] = static_cast<std::uint16_t>(bottom);
+    }
+    if (direction == ScrollDirection::RightToLeft) {
+        x = width;
+    } else /* direction == ScrollDirection::LeftToRight */ {
+        x = -width;
+    }
+}
+
+template<typename Fn>
+Rectangle Scroller::ForEachWaveColumn(const Rectangle& clip, int y, Fn draw) const
+{
+    // The wave stays in place on the screen while the text moves through it
+    const auto left = x + strip.offset.x;
+    const auto top = y + strip.offset.y;
+    const auto c0 = std::max(clip.point.x - left, 0);
+    const auto c1 = std::min(clip.point.x + clip.size.width - left, strip.size.width);
+    const auto clip_bottom = clip.point.y + clip.size.height;
+    const auto& sine = SineTable();
+    const auto step = 65536 / std::max(wave_length, 1);
+    int covered_top = INT_MAX, covered_bottom = INT_MIN;
+    for (int column = c0; column < c1; ++column) {
+        const auto sx = left + column;
+        const auto phase = static_cast<std::uint16_t>(wave_phase + sx * step);
+        const auto offset = (wave_amplitude * sine[phase >> (16 - SineBits)] + (1 << (SineShift - 1))) >> SineShift;
+        const auto y0 = std::max(top + offset + column_top[column], clip.point.y);
+        const auto y1 = std::min(top + offset + column_bottom[column], clip_bottom);
+        if (y0 >= y1)
+            continue;
+        draw(sx, y0, y1, &columns[column * strip.size.height + y0 - top - offset]);
+        covered_top = std::min(covered_top, y0);
+        covered_bottom = std::max(covered_bottom, y1);
+    }
+    if (covered_top >= covered_bottom)
+        return {};
+    return Rectangle{{left + c0, covered_top}, {c1 - c0, covered_bottom - covered_top}};
+}
+
+void Scroller::Draw(PixelBuffer& pb, const Colour& colour, int y) const
+{
+    if (wave_amplitude == 0) {
+        font::DrawCoverage(pb, strip, { x, y }, colour);
+        return;
+    }
+
+    const PixelValue c = colour;
+    const auto stride = pb.GetSize().width;
+    pb.MarkDamaged(ForEachWaveColumn(pb.GetClip(), y, [&](int sx, int y0, int y1, const std::uint8_t* mask) {
+        blend::MaskColumn(&pb.buffer[y0 * stride + sx], stride, mask, c, y1 - y0);
+    }));
+}
+
+void Scroller::Draw(IndexedPixelBuffer& ib, std::uint8_t first, int levels, int y) const
+{
+    if (wave_amplitude == 0) {
+        ib.DrawMask(Point{ x, y } + strip.offset, strip.size, strip.mask.data(), strip.size.width, first, levels);
+        return;
+    }
+
+    const auto stride = ib.GetSize().width;
+    ib.damage.Add(ForEachWaveColumn(Rectangle{{}, ib.GetSize()}, y, [&](int sx, int y0, int y1, const std::uint8_t* mask) {
+        indexed::MaskColumn(&ib.buffer[y0 * stride + sx], stride, mask, first, levels, y1 - y0);
+    }));
+}
+
+void Scroller::Advance(int screen_width)
+{
+    wave_phase += wave_speed;
+    if (direction == ScrollDirection::RightToLeft) {
+        x -= speed;
+        if (x < -width)
+            x = screen_width;
+    } else /* direction == ScrollDirection::LeftToRight */ {
+        x += speed;
+        if (x > screen_width)
+            x = -width;
+    }
+}
+
+void Scroller::Update(PixelBuffer& pb, const Colour& colour, int y)
+{
+    Draw(pb, colour, y);
+    Advance(pb.GetSize().width);
+}
+
+Copper::Copper(int height)
+    : scanline(height), lit(height)
+{
+}
+
+void Copper::Add(const CopperBar& bar)
+{
+    if (bar.height <= 0 || bar.period <= 0)
+        throw std::runtime_error("invalid copper bar");
+
+    const auto half_height = bar.height / 2;
+    const auto first = static_cast<int>(colours.size());
+    colours.resize(first + 2 * half_height);
+    const auto gradient = &colours[first];
+    for (int j = 0; j < half_height; ++j) {
+        const auto alpha = j * 255 / half_height;
+        gradient[j] = BlendPixel(bar.edge, bar.middle, alpha);
+        gradient[half_height + j] = BlendPixel(bar.middle, bar.edge, alpha);
+    }
+    const auto phase = static_cast<std::uint16_t>((bar.phase % bar.period) * 65536 / bar.period);
+    const auto speed = static_cast<std::uint16_t>(65536 / bar.period);
+    bars.push_back(Bar{first, 2 * half_height, bar.centre, bar.amplitude, phase, speed});
+}
+
+void Copper::Advance()
+{
+    if (lit_top < lit_bottom)
+        std::fill(lit.begin() + lit_top, lit.begin() + lit_bottom, 0);
+    lit_top = static_cast<int>(lit.size());
+    lit_bottom = 0;
+
+    const auto& sine = SineTable();
+    const auto height = static_cast<int>(scanline.size());
+    for (auto& bar : bars) {
+        bar.phase += bar.speed;
+        const auto s = sine[bar.phase >> (16 - SineBits)];
+        const auto top = bar.centre + ((bar.amplitude * s + (1 << (SineShift - 1))) >> SineShift) - bar.size / 2;
+        const auto y0 = std::max(top, 0);
+        const auto y1 = std::min(top + bar.size, height);
+        if (y0 >= y1)
+            continue;
+        for (int y = y0; y < y1; ++y)
+            scanline[y] = static_cast<std::uint16_t>(bar.first + y - top);
+        std::fill(&lit[y0], &lit[y1], 1);
+        lit_top = std::min(lit_top, y0);
+        lit_bottom = std::max(lit_bottom, y1);
+    }
+}
+
+void Copper::Draw(PixelBuffer& pb) const
+{
+    const Span row{0, pb.GetSize().width};
+    const auto bottom = std::min(lit_bottom, pb.GetSize().height);
+    for (int y = lit_top; y < bottom; ++y) {
+        if (lit[y])
+            pb.FillSpan(y, row, colours[scanline[y]]);
+    }
+}
+
+void Copper::Draw(IndexedPixelBuffer& ib, std::uint8_t first) const
+{
+    const Span row{0, ib.GetSize().width};
+    const auto bottom = std::min(lit_bottom, ib.GetSize().height);
+    for (int y = lit_top; y < bottom; ++y) {
+        if (lit[y])
+            ib.FillSpan(y, row, static_cast<std::uint8_t>(first + scanline[y]));
+    }
+}
+
+void Copper::SetPalette(IndexedPixelBuffer& ib, std::uint8_t first) const
+{
+    if (first + colours.size() > ib.palette.size())
+        throw std::runtime_error("copper bars do not fit in the palette");
+    std::copy(colours.begin(), colours.end(), &ib.palette[first]);
+    ib.palette_changed = true;
+}
+
+void Copper::Update(PixelBuffer& pb)
+{
+    Advance();
+    Draw(pb);
+}
+
+Starfield::Starfield(const Rectangle& r, std::uint32_t seed, const int count, const int layers)
+    : rect(r), rng(seed), x(count), y(count), layer_start(layers + 1), speed(layers), colour(layers)
+{
+    if (count < 0 || layers <= 0)
+        throw std::runtime_error("invalid starfield");
+
+    for (int n = 0; n < layers; ++n) {
+        layer_start[n] = count * n / layers;
+        speed[n] = n + 1;
+        const auto intensity = layers > 1 ? n * 255 / (layers - 1) : 255;
+        colour[n] = BlendPixel(Colour{0, 0, 0}, Colour{255, 255, 255}, intensity);
+    }
+    layer_start[layers] = count;
+    for (int n = 0; n < count; ++n)
+        Respawn(n);
+}
+
+void Starfield::Respawn(size_t n)
+{
+    x[n] = rect.point.x + rect.size.width + static_cast<int>(rng.Below(21));
+    y[n] = rect.point.y + static_cast<int>(rng.Below(rect.size.height));
+}
+
+void Starfield::Draw(PixelBuffer& pb) const
+{
+    const auto clip = ClipTo(rect, pb.GetClip());
+    if (clip.size.width <= 0 || clip.size.height <= 0)
+        return;
+
+    // Damage is added a row at a time rather than per star
+    std::vector<Span> rows(clip.size.height);
+    for (size_t layer = 0; layer < speed.size(); ++layer) {
+        const auto begin = layer_start[layer];
+        Plot(pb.buffer, pb.GetSize().width, clip, &x[begin], &y[begin], layer_start[layer + 1] - begin, colour[layer], rows.data());
+    }
+    for (int n = 0; n < clip.size.height; ++n)
+        pb.damage.Add(clip.point.y + n, rows[n].x0, rows[n].x1);
+}
+
+void Starfield::Draw(IndexedPixelBuffer& ib, std::uint8_t first) const
+{
+    const auto clip = ClipTo(rect, Rectangle{{}, ib.GetSize()});
+    if (clip.size.width <= 0 || clip.size.height <= 0)
+        return;
+
+    std::vector<Span> rows(clip.size.height);
+    for (size_t layer = 0; layer < speed.size(); ++layer) {
+        const auto begin = layer_start[layer];
+        const auto index = static_cast<std::uint8_t>(first + layer);
+        Plot(ib.buffer, ib.GetSize().width, clip, &x[begin], &y[begin], layer_start[layer + 1] - begin, index, rows.data());
+    }
+    for (int n = 0; n < clip.size.height; ++n)
+        ib.damage.Add(clip.point.y + n, rows[n].x0, rows[n].x1);
+}
+
+void Starfield::SetPalette(IndexedPixelBuffer& ib, std::uint8_t first) const
+{
+    if (first + colour.size() > ib.palette.size())
+        throw std::runtime_error("starfield does not fit in the palette");
+    std::copy(colour.begin(), colour.end(), &ib.palette[first]);
+    ib.palette_changed = true;
+}
+
+void Starfield::Advance()
+{
+    const auto left = rect.point.x;
+    for (size_t layer = 0; layer < speed.size(); ++layer) {
+        const auto begin = layer_start[layer];
+        const auto end = layer_start[layer + 1];
+        MoveLeft(&x[begin], end - begin, speed[layer], left, [&](int n) { Respawn(begin + n); });
+    }
+}
+
+void Starfield::Update(PixelBuffer& pb)
+{
+    Draw(pb);
+    Advance();
+}
+
+Plasma::Plasma(const Rectangle& r)
+    : rect(r), a(r.size.width), b(r.size.width + 256), shift(r.size.height), c(r.size.height)
+{
+    const auto& sine = ByteSineTable();
+    for (int n = 0; n < 256; ++n)
+        palette[n] = Colour{sine[n], sine[(n + 85) & 255], sine[(n + 170) & 255]};
+    Advance();
+}
+
+void Plasma::Draw(PixelBuffer& pb) const
+{
+    const auto area = ClipTo(rect, pb.GetClip());
+    if (area.size.width <= 0 || area.size.height <= 0)
+        return;
+
+    std::array<std::uint8_t, ChunkSize> index;
+    const auto left = area.point.x - rect.point.x;
+    for (int y = area.point.y; y < area.point.y + area.size.height; ++y) {
+        const auto row = y - rect.point.y;
+        const auto dest = &pb.buffer[y * pb.GetSize().width + area.point.x];
+        for (int x = 0; x < area.size.width; x += ChunkSize) {
+            const auto count = std::min(ChunkSize, area.size.width - x);
+            AddBytes(index.data(), &a[left + x], &b[left + x + shift[row]], c[row], count);
+            indexed::Expand(dest + x, index.data(), palette.data(), count);
+        }
+    }
+    pb.MarkDamaged(area);
+}
+
+void Plasma::Advance()
+{
+    ++time;
+    const auto& sine = ByteSineTable();
+    const auto width = rect.size.width, height = rect.size.height;
+    // As many waves across whatever the size is
+    for (int x = 0; x < width; ++x)
+        a[x] = sine[(x * 512 / width + 3 * time) & 255] / 2;
+    for (int x = 0; x < width + 256; ++x)
+        b[x] = sine[(x * 768 / width - 2 * time) & 255] / 2;
+    for (int y = 0; y < height; ++y) {
+        shift[y] = sine[(y * 256 / height + time) & 255];
+        c[y] = sine[(y * 512 / height + 5 * time) & 255] / 2;
+    }
+}
+
+void Plasma::Update(PixelBuffer& pb)
+{
+    Draw(pb);
+    Advance();
+}
+
+Rotozoom::Rotozoom(const Rectangle& r)
+    : rect(r)
+{
+    Advance();
+}
+
+void Rotozoom::Draw(PixelBuffer& pb) const
+{
+    const auto area = ClipTo(rect, pb.GetClip());
+    if (area.size.width <= 0 || area.size.height <= 0)
+        return;
+
+    const auto& texture = Texture();
+    std::array<std::uint32_t, ChunkSize> index;
+    const std::uint32_t left = area.point.x - rect.point.x;
+    for (int y = area.point.y; y < area.point.y + area.size.height; ++y) {
+        const std::uint32_t row = y - rect.point.y;
+        auto u = u0 + left * du - row * dv;
+        auto v = v0 + left * dv + row * du;
+        const auto dest = &pb.buffer[y * pb.GetSize().width + area.point.x];
+        for (int x = 0; x < area.size.width; x += ChunkSize) {
+            const auto count = std::min(ChunkSize, area.size.width - x);
+            TextureRow(index.data(), u, v, du, dv, count);
+            indexed::Expand(dest + x, index.data(), texture.data(), count);
+            u += count * du;
+            v += count * dv;
+        }
+    }
+    pb.MarkDamaged(area);
+}
+
+void Rotozoom::Advance()
+{
+    angle += 96;
+    zoom += 160;
+    const auto& sine = SineTable();
+    const auto at = [&](std::uint16_t phase) { return sine[phase >> (16 - SineBits)]; };
+    // Texels per pixel, in 8.8 fixed point: between 0.5 and 2.5
+    const auto scale = 384 + (at(zoom) >> (SineShift - 8));
+    du = static_cast<std::uint32_t>(at(angle + 16384) * scale >> (SineShift + 8 - 16));
+    dv = static_cast<std::uint32_t>(at(angle) * scale >> (SineShift + 8 - 16));
+    // The middle of the texture stays in the middle of rect
+    const std::uint32_t centre = 128 << 16;
+    const std::uint32_t half_width = rect.size.width / 2, half_height = rect.size.height / 2;
+    u0 = centre - half_width * du + half_height * dv;
+    v0 = centre - half_width * dv - half_height * du;
+}
+
+void Rotozoom::Update(PixelBuffer& pb)
+{
+    Draw(pb);
+    Advance();
+}
+
+Tunnel::Tunnel(const Rectangle& r)
+    : rect(r), coordinates(r.size.width * r.size.height)
+{
+    // The texture repeats every 256 steps of depth, the edge of rect is
+    // about 32 steps away
+    const auto ratio = 16.0 * std::min(r.size.width, r.size.height);
+    for (int y = 0; y < r.size.height; ++y) {
+        for (int x = 0; x < r.size.width; ++x) {
+            const auto dx = x - r.size.width / 2.0 + 0.5;
+            const auto dy = y - r.size.height / 2.0 + 0.5;
+            // The centre pixel of an odd size is at distance 0
+            const auto distance = std::max(std::sqrt(dx * dx + dy * dy), 0.5);
+            const auto depth = static_cast<int>(ratio / distance) & 255;
+            const auto angle = static_cast<int>(std::floor(128 * std::atan2(dy, dx) / M_PI)) & 255;
+            coordinates[y * r.size.width + x] = static_cast<std::uint16_t>(depth << 8 | angle);
+        }
+    }
+}
+
+void Tunnel::Draw(PixelBuffer& pb) const
+{
+    const auto area = ClipTo(rect, pb.GetClip());
+    if (area.size.width <= 0 || area.size.height <= 0)
+        return;
+
+    const auto& texture = Texture();
+    std::array<std::uint16_t, ChunkSize> index;
+    const auto offset = static_cast<std::uint16_t>(depth << 8 | turn);
+    for (int y = area.point.y; y < area.point.y + area.size.height; ++y) {
+        const auto source = &coordinates[(y - rect.point.y) * rect.size.width + area.point.x - rect.point.x];
+        const auto dest = &pb.buffer[y * pb.GetSize().width + area.point.x];
+        for (int x = 0; x < area.size.width; x += ChunkSize) {
+            const auto count = std::min(ChunkSize, area.size.width - x);
+            AddBytePairs(index.data(), source + x, offset, count);
+            indexed::Expand(dest + x, index.data(), texture.data(), count);
+        }
+    }
+    pb.MarkDamaged(area);
+}
+
+void Tunnel::Advance()
+{
+    ++turn;
+    depth += 4;
+}
+
+void Tunnel::Update(PixelBuffer& pb)
+{
+    Draw(pb);
+    Advance();
+}
+
+}
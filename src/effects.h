@@ -0,0 +1,205 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "font.h"
+#include "types.h"
+#include "util.h"
+
+struct PixelBuffer;
+struct IndexedPixelBuffer;
+
+namespace effects {
+
+enum class ScrollDirection {
+    RightToLeft,
+    LeftToRight,
+};
+
+struct Scroller
+{
+    font::Font& font;
+    int speed{1};
+    ScrollDirection direction;
+    int x{0};
+    std::string text;
+    int width{0};
+    // Text is rendered once, only blending is done every frame
+    font::Coverage strip;
+    // Moves every column of the text up and down along a sine wave by up to
+    // this many pixels; 0 scrolls in a straight line
+    int wave_amplitude{0};
+    // Width of a period of the wave in pixels, and how far it moves each
+    // frame, where 65536 is a whole period
+    int wave_length{160};
+    int wave_speed{1024};
+    std::uint16_t wave_phase{};
+    // The strip in column-major order, and the rows of each column that
+    // have any coverage
+    std::vector<std::uint8_t> columns;
+    std::vector<std::uint16_t> column_top, column_bottom;
+
+    // Calls draw(x, y0, y1, mask) for the rows [y0, y1) within clip of every
+    // column of the strip, moved along the wave; mask is the coverage of
+    // row y0. Returns the area covered
+    template<typename Fn>
+    Rectangle ForEachWaveColumn(const Rectangle& clip, int y, Fn draw) const;
+
+    void SetText(std::string sv);
+    void Draw(PixelBuffer& pb, const Colour& colour, int y) const;
+    // Uses the levels palette entries from first, by coverage
+    void Draw(IndexedPixelBuffer& ib, std::uint8_t first, int levels, int y) const;
+    // Moves the text along, wrapping around at the edges of a screen this wide
+    void Advance(int screen_width);
+    // Draws, then advances
+    void Update(PixelBuffer& pb, const Colour& colour, int y);
+};
+
+struct CopperBar
+{
+    int height;
+    // Colour at the top and bottom, and in the middle
+    Colour edge, middle;
+    // The middle is at centre + amplitude * sin(2 pi (frame + phase) / period)
+    int centre, amplitude, period, phase{};
+};
+
+// Draws horizontal bars of gradients that move up and down; later bars are
+// on top of earlier ones
+class Copper
+{
+    struct Bar
+    {
+        // Gradient of the rows, top first, in colours
+        int first, size;
+        int centre, amplitude;
+        // A full period is 65536
+        std::uint16_t phase, speed;
+    };
+    std::vector<Bar> bars;
+    std::vector<PixelValue> colours;
+    // Index in colours of each row this frame, if any bar covers it
+    std::vector<std::uint16_t> scanline;
+    std::vector<std::uint8_t> lit;
+    int lit_top{}, lit_bottom{};
+
+public:
+    explicit Copper(int height);
+
+    void Add(const CopperBar& bar);
+
+    // Moves the bars and works out the colour of every row
+    void Advance();
+    // One span fill per row covered by a bar
+    void Draw(PixelBuffer& pb) const;
+    // Takes colours from the palette, starting at first; see SetPalette()
+    void Draw(IndexedPixelBuffer& ib, std::uint8_t first) const;
+    // Number of palette entries needed to draw all bars
+    int GetColourCount() const { return static_cast<int>(colours.size()); }
+    void SetPalette(IndexedPixelBuffer& ib, std::uint8_t first) const;
+    // Advances, then draws
+    void Update(PixelBuffer& pb);
+};
+
+// Stars moving right to left in layers; the further away a layer is, the
+// slower and dimmer its stars are
+class Starfield
+{
+    const Rectangle rect;
+    util::XorShift rng;
+    // Positions of all stars, by layer; the stars of layer n are at
+    // [layer_start[n], layer_start[n + 1]), the furthest layer first
+    std::vector<std::int32_t> x, y;
+    std::vector<int> layer_start;
+    // Per layer, in pixels per frame
+    std::vector<std::int32_t> speed;
+    std::vector<PixelValue> colour;
+
+    void Respawn(size_t n);
+
+public:
+    static constexpr inline int DefaultCount = 100;
+    static constexpr inline int DefaultLayers = 10;
+
+    Starfield(const Rectangle& r, std::uint32_t seed, const int count = DefaultCount, const int layers = DefaultLayers);
+
+    int GetCount() const { return static_cast<int>(x.size()); }
+
+    int GetLayerCount() const { return static_cast<int>(speed.size()); }
+
+    void Draw(PixelBuffer& pb) const;
+    // Layer n uses palette entry first + n; see SetPalette()
+    void Draw(IndexedPixelBuffer& ib, std::uint8_t first) const;
+    void SetPalette(IndexedPixelBuffer& ib, std::uint8_t first) const;
+    void Advance();
+    // Draws, then advances
+    void Update(PixelBuffer& pb);
+};
+
+// The effects below fill all of a rectangle, a row at a time, using tables
+// built on construction; per pixel, only additions and lookups are done
+
+// Sums of sines, coloured by a cyclic palette
+class Plasma
+{
+    const Rectangle rect;
+    std::array<PixelValue, 256> palette;
+    // Of this frame: the value is a[x] + b[x + shift[y]] + c[y], wrapping
+    std::vector<std::uint8_t> a, b, shift, c;
+    std::uint16_t time{};
+
+public:
+    explicit Plasma(const Rectangle& r);
+
+    void Draw(PixelBuffer& pb) const;
+    void Advance();
+    // Draws, then advances
+    void Update(PixelBuffer& pb);
+};
+
+// A texture, rotated and zoomed around the centre
+class Rotozoom
+{
+    const Rectangle rect;
+    // Texture coordinates of the top-left pixel and their steps per column,
+    // in 16.16 fixed point; a row down is a step of (-dv, du)
+    std::uint32_t u0{}, v0{}, du{}, dv{};
+    std::uint16_t angle{}, zoom{};
+
+public:
+    explicit Rotozoom(const Rectangle& r);
+
+    void Draw(PixelBuffer& pb) const;
+    void Advance();
+    // Draws, then advances
+    void Update(PixelBuffer& pb);
+};
+
+// Flying through a textured tube
+class Tunnel
+{
+    const Rectangle rect;
+    // Texture coordinates of every pixel: the angle around the centre in the
+    // low byte, the depth in the high byte
+    std::vector<std::uint16_t> coordinates;
+    // Added to both bytes of every coordinate, without carrying
+    std::uint8_t turn{}, depth{};
+
+public:
+    explicit Tunnel(const Rectangle& r);
+
+    void Draw(PixelBuffer& pb) const;
+    void Advance();
+    // Draws, then advances
+    void Update(PixelBuffer& pb);
+};
+
+}
@@ -5,72 +5,531 @@
  * For conditions of distribution and use, see LICENSE file
  */
 #include "font.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
 #include <stdexcept>
 #include "types.h"
+#include "blend.h"
 #include "pixelbuffer.h"
+#include "util.h"
+#include "spdlog/spdlog.h"
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "../3rdparty/stb/stb_truetype.h"
 
 namespace font {
 
-    Font::Font(std::vector<std::byte> data, const int font_size)
-        : font_data(std::move(data))
+    namespace {
+        // Increase whenever the layout below or the atlas range changes
+        constexpr inline uint32_t BakedVersion = 1;
+        constexpr inline char BakedMagic[4] = { 'P', 'P', 'G', 'F' };
+        constexpr inline int GlyphCount = Font::LastCodepoint - Font::FirstCodepoint + 1;
+
+        struct BakedHeader
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t font_hash;
+            int32_t font_size;
+            int32_t subpixel_bits;
+            float scale;
+            int32_t baseline;
+            uint32_t kern_count;
+            uint32_t atlas_size;
+        };
+
+        // Byte offsets of the tables following the header, each 4-byte aligned
+        struct BakedLayout
+        {
+            size_t glyph_offset, glyph_width, glyph_height, glyph_x0, glyph_y0, glyph_advance;
+            size_t kern_index, kern_second, kern_amount, atlas, total;
+        };
+
+        BakedLayout GetLayout(const BakedHeader& header)
+        {
+            const size_t variants = GlyphCount << header.subpixel_bits;
+            size_t offset = sizeof(BakedHeader);
+            const auto table = [&](size_t length) {
+                const auto start = offset;
+                offset = (offset + length + 3) & ~size_t{3};
+                return start;
+            };
+            BakedLayout layout;
+            layout.glyph_offset = table(variants * sizeof(uint32_t));
+            layout.glyph_width = table(variants * sizeof(uint16_t));
+            layout.glyph_height = table(variants * sizeof(uint16_t));
+            layout.glyph_x0 = table(variants * sizeof(int16_t));
+            layout.glyph_y0 = table(variants * sizeof(int16_t));
+            layout.glyph_advance = table(GlyphCount * sizeof(int32_t));
+            layout.kern_index = table((GlyphCount + 1) * sizeof(uint16_t));
+            layout.kern_second = table(header.kern_count * sizeof(uint8_t));
+            layout.kern_amount = table(header.kern_count * sizeof(int16_t));
+            layout.atlas = table(header.atlas_size);
+            layout.total = offset;
+            return layout;
+        }
+
+        // FNV-1a, to tell whether a baked image belongs to the font data
+        uint64_t Hash(std::span<const std::byte> data)
+        {
+            uint64_t hash = 0xcbf29ce484222325;
+            for (const auto b : data) {
+                hash ^= static_cast<uint8_t>(b);
+                hash *= 0x100000001b3;
+            }
+            return hash;
+        }
+
+        int SubpixelBits(const Positioning positioning)
+        {
+            return positioning == Positioning::QuarterPixel ? 2 : 0;
+        }
+
+        // Kerning of all pairs in the atlas range; see Font for the layout
+        void BuildKerning(const stbtt_fontinfo& font_info, const float scale, std::vector<uint16_t>& kern_index,
+            std::vector<uint8_t>& kern_second, std::vector<int16_t>& kern_amount)
+        {
+            kern_index.resize(GlyphCount + 1);
+            for (int first = 0; first < GlyphCount; ++first) {
+                kern_index[first] = kern_second.size();
+                for (int second = 0; second < GlyphCount; ++second) {
+                    const auto kern = stbtt_GetCodepointKernAdvance(&font_info, Font::FirstCodepoint + first, Font::FirstCodepoint + second);
+                    if (kern == 0)
+                        continue;
+                    kern_second.push_back(second);
+                    kern_amount.push_back(std::lround(kern * scale * FixedOne));
+                }
+            }
+            kern_index[GlyphCount] = kern_second.size();
+        }
+
+        int FindKerning(std::span<const uint16_t> kern_index, std::span<const uint8_t> kern_second,
+            std::span<const int16_t> kern_amount, const char32_t first, const char32_t second)
+        {
+            if (first < Font::FirstCodepoint || first > Font::LastCodepoint || second < Font::FirstCodepoint || second > Font::LastCodepoint)
+                return 0;
+            const auto begin = kern_second.begin() + kern_index[first - Font::FirstCodepoint];
+            const auto end = kern_second.begin() + kern_index[first - Font::FirstCodepoint + 1];
+            const auto it = std::lower_bound(begin, end, second - Font::FirstCodepoint);
+            if (it == end || *it != second - Font::FirstCodepoint)
+                return 0;
+            return kern_amount[it - kern_second.begin()];
+        }
+
+        template<typename T>
+        std::span<const T> GetTable(std::span<const std::byte> image, size_t offset, size_t count)
+        {
+            return { reinterpret_cast<const T*>(image.data() + offset), count };
+        }
+
+        template<typename T>
+        void PutTable(std::vector<std::byte>& image, size_t offset, const std::vector<T>& table)
+        {
+            std::memcpy(image.data() + offset, table.data(), table.size() * sizeof(T));
+        }
+    }
+
+    std::vector<std::byte> Bake(std::span<const std::byte> data, const int font_size, const Positioning positioning)
     {
-        if (!stbtt_InitFont(&font_info, reinterpret_cast<const unsigned char*>(font_data.data()), 0))
+        stbtt_fontinfo font_info;
+        if (!stbtt_InitFont(&font_info, reinterpret_cast<const unsigned char*>(data.data()), 0))
             throw std::runtime_error("unable to initialize font");
 
-        scale = stbtt_ScaleForPixelHeight(&font_info, font_size);
+        BakedHeader header{};
+        std::copy(std::begin(BakedMagic), std::end(BakedMagic), header.magic);
+        header.version = BakedVersion;
+        header.font_hash = Hash(data);
+        header.font_size = font_size;
+        header.subpixel_bits = SubpixelBits(positioning);
+        header.scale = stbtt_ScaleForPixelHeight(&font_info, font_size);
         int ascent;
         stbtt_GetFontVMetrics(&font_info, &ascent, 0, 0);
-        baseline = static_cast<int>(ascent * scale);
+        header.baseline = static_cast<int>(ascent * header.scale);
+        const auto scale = header.scale;
+
+        const auto variants = 1 << header.subpixel_bits;
+        std::vector<uint32_t> glyph_offset(GlyphCount * variants);
+        std::vector<uint16_t> glyph_width(GlyphCount * variants);
+        std::vector<uint16_t> glyph_height(GlyphCount * variants);
+        std::vector<int16_t> glyph_x0(GlyphCount * variants);
+        std::vector<int16_t> glyph_y0(GlyphCount * variants);
+        std::vector<int32_t> glyph_advance(GlyphCount);
+        for (int n = 0; n < GlyphCount; ++n) {
+            const auto ch = Font::FirstCodepoint + n;
+            int advance, lsb;
+            stbtt_GetCodepointHMetrics(&font_info, ch, &advance, &lsb);
+            glyph_advance[n] = std::lround(advance * scale * FixedOne);
+
+            for (int v = 0; v < variants; ++v) {
+                const auto i = n << header.subpixel_bits | v;
+                const auto shift_x = static_cast<float>(v) / variants;
+                int x0, y0, x1, y1;
+                stbtt_GetCodepointBitmapBoxSubpixel(&font_info, ch, scale, scale, shift_x, 0.0f, &x0, &y0, &x1, &y1);
+                glyph_offset[i] = header.atlas_size;
+                glyph_width[i] = x1 - x0;
+                glyph_height[i] = y1 - y0;
+                glyph_x0[i] = x0;
+                glyph_y0[i] = y0;
+                header.atlas_size += glyph_width[i] * glyph_height[i];
+            }
+        }
+
+        std::vector<uint16_t> kern_index;
+        std::vector<uint8_t> kern_second;
+        std::vector<int16_t> kern_amount;
+        BuildKerning(font_info, scale, kern_index, kern_second, kern_amount);
+        header.kern_count = kern_second.size();
+
+        const auto layout = GetLayout(header);
+        std::vector<std::byte> image(layout.total);
+        std::memcpy(image.data(), &header, sizeof(header));
+        PutTable(image, layout.glyph_offset, glyph_offset);
+        PutTable(image, layout.glyph_width, glyph_width);
+        PutTable(image, layout.glyph_height, glyph_height);
+        PutTable(image, layout.glyph_x0, glyph_x0);
+        PutTable(image, layout.glyph_y0, glyph_y0);
+        PutTable(image, layout.glyph_advance, glyph_advance);
+        PutTable(image, layout.kern_index, kern_index);
+        PutTable(image, layout.kern_second, kern_second);
+        PutTable(image, layout.kern_amount, kern_amount);
+
+        const auto atlas = reinterpret_cast<unsigned char*>(image.data() + layout.atlas);
+        for (int i = 0; i < GlyphCount * variants; ++i) {
+            if (glyph_width[i] == 0 || glyph_height[i] == 0)
+                continue;
+            const auto shift_x = static_cast<float>(i & (variants - 1)) / variants;
+            stbtt_MakeCodepointBitmapSubpixel(&font_info, atlas + glyph_offset[i], glyph_width[i], glyph_height[i],
+                glyph_width[i], scale, scale, shift_x, 0.0f, Font::FirstCodepoint + (i >> header.subpixel_bits));
+        }
+        return image;
+    }
+
+    Font::Font(std::vector<std::byte> data, const int font_size, const Positioning positioning, const size_t cache_capacity)
+        : Font(std::move(data), font_size, positioning, nullptr, cache_capacity)
+    {
+    }
+
+    Font::Font(std::vector<std::byte> data, const int font_size, const Positioning positioning, const char* baked_path, const size_t cache_capacity)
+        : subpixel_bits(SubpixelBits(positioning))
+        , cache_capacity(std::max<size_t>(cache_capacity, 1)), font_data(std::move(data))
+    {
+        // Glyphs outside the atlas are still rasterized from the font itself
+        if (!stbtt_InitFont(&font_info, reinterpret_cast<const unsigned char*>(font_data.data()), 0))
+            throw std::runtime_error("unable to initialize font");
+
+        if (baked_path) {
+            try {
+                baked_file = std::make_unique<util::MappedFile>(baked_path);
+                if (Attach(baked_file->GetData(), font_size))
+                    return;
+                spdlog::warn("{} is stale, rasterizing glyphs", baked_path);
+            } catch (std::runtime_error& e) {
+                spdlog::warn("cannot use {}: {}, rasterizing glyphs", baked_path, e.what());
+            }
+            baked_file.reset();
+        }
+
+        baked = Bake(font_data, font_size, positioning);
+        if (!Attach(baked, font_size))
+            throw std::runtime_error("unable to bake font");
+    }
+
+    bool Font::Attach(std::span<const std::byte> image, const int font_size)
+    {
+        BakedHeader header;
+        if (image.size() < sizeof(header))
+            return false;
+        std::memcpy(&header, image.data(), sizeof(header));
+        if (!std::equal(std::begin(BakedMagic), std::end(BakedMagic), header.magic) || header.version != BakedVersion ||
+            header.font_size != font_size || header.subpixel_bits != subpixel_bits || header.font_hash != Hash(font_data))
+            return false;
+        const auto layout = GetLayout(header);
+        if (image.size() < layout.total)
+            return false;
+
+        const size_t variants = GlyphCount << subpixel_bits;
+        glyph_offset = GetTable<uint32_t>(image, layout.glyph_offset, variants);
+        glyph_width = GetTable<uint16_t>(image, layout.glyph_width, variants);
+        glyph_height = GetTable<uint16_t>(image, layout.glyph_height, variants);
+        glyph_x0 = GetTable<int16_t>(image, layout.glyph_x0, variants);
+        glyph_y0 = GetTable<int16_t>(image, layout.glyph_y0, variants);
+        glyph_advance = GetTable<int32_t>(image, layout.glyph_advance, GlyphCount);
+        kern_index = GetTable<uint16_t>(image, layout.kern_index, GlyphCount + 1);
+        kern_second = GetTable<uint8_t>(image, layout.kern_second, header.kern_count);
+        kern_amount = GetTable<int16_t>(image, layout.kern_amount, header.kern_count);
+        atlas = GetTable<uint8_t>(image, layout.atlas, header.atlas_size);
+        scale = header.scale;
+        baseline = header.baseline;
+        return true;
+    }
+
+    int Font::GetKerning(const char32_t first, const char32_t second) const
+    {
+        return FindKerning(kern_index, kern_second, kern_amount, first, second);
     }
 
-    const Glyph& Font::GetGlyph(const int ch)
+    SdfFont::SdfFont(std::span<const std::byte> data)
     {
-        auto& g = glyph[ch];
-        if (g.bitmap.empty()) {
-            int h, w;
-            const auto bitmap = stbtt_GetCodepointBitmap(&font_info, 0, scale, ch, &w, &h, 0, 0);
-            float x_shift = 0.0f;
-            int x0, y0, x1, y1;
-            stbtt_GetCodepointBitmapBoxSubpixel( &font_info, ch, scale, scale, x_shift, 0, &x0, &y0, &x1, &y1);
+        stbtt_fontinfo font_info;
+        if (!stbtt_InitFont(&font_info, reinterpret_cast<const unsigned char*>(data.data()), 0))
+            throw std::runtime_error("unable to initialize font");
+
+        const auto scale = stbtt_ScaleForPixelHeight(&font_info, BaseSize);
+        int ascent_units;
+        stbtt_GetFontVMetrics(&font_info, &ascent_units, 0, 0);
+        ascent = ascent_units * scale;
+
+        glyph_offset.resize(GlyphCount);
+        glyph_width.resize(GlyphCount);
+        glyph_height.resize(GlyphCount);
+        glyph_x0.resize(GlyphCount);
+        glyph_y0.resize(GlyphCount);
+        glyph_advance.resize(GlyphCount);
+        for (int n = 0; n < GlyphCount; ++n) {
+            const auto ch = Font::FirstCodepoint + n;
             int advance, lsb;
             stbtt_GetCodepointHMetrics(&font_info, ch, &advance, &lsb);
+            glyph_advance[n] = std::lround(advance * scale * FixedOne);
 
-            g = Glyph{h, w, y0, advance, {&bitmap[0], &bitmap[h * w]}};
+            int width, height, x0, y0;
+            glyph_offset[n] = atlas.size();
+            const auto field = stbtt_GetCodepointSDF(&font_info, scale, ch, Padding, OnEdge, PixelDistScale, &width, &height, &x0, &y0);
+            if (!field)
+                continue; // nothing to draw, e.g. a space
+            glyph_width[n] = width;
+            glyph_height[n] = height;
+            glyph_x0[n] = x0;
+            glyph_y0[n] = y0;
+            atlas.insert(atlas.end(), field, field + width * height);
+            stbtt_FreeSDF(field, nullptr);
+        }
+        BuildKerning(font_info, scale, kern_index, kern_second, kern_amount);
+    }
+
+    int SdfFont::GetKerning(const char32_t first, const char32_t second) const
+    {
+        return FindKerning(kern_index, kern_second, kern_amount, first, second);
+    }
+
+    Glyph Font::GetCachedGlyph(const char32_t ch)
+    {
+        if (const auto it = cache_index.find(ch); it != cache_index.end()) {
+            ++cache_statistics.hits;
+            cache.splice(cache.begin(), cache, it->second);
+        } else {
+            ++cache_statistics.misses;
+            if (cache.size() < cache_capacity) {
+                cache.emplace_front();
+            } else {
+                // Recycle the least recently used entry, bitmap storage included
+                ++cache_statistics.evictions;
+                cache_index.erase(cache.back().codepoint);
+                cache.splice(cache.begin(), cache, std::prev(cache.end()));
+            }
+
+            auto& g = cache.front();
+            g.codepoint = ch;
+            g.missing = stbtt_FindGlyphIndex(&font_info, ch) == 0;
+            if (!g.missing) {
+                int x0, y0, x1, y1;
+                stbtt_GetCodepointBitmapBox(&font_info, ch, scale, scale, &x0, &y0, &x1, &y1);
+                int advance, lsb;
+                stbtt_GetCodepointHMetrics(&font_info, ch, &advance, &lsb);
+                g.width = x1 - x0;
+                g.height = y1 - y0;
+                g.x0 = x0;
+                g.y0 = y0;
+                g.advance = std::lround(advance * scale * FixedOne);
+                g.bitmap.resize(g.width * g.height);
+                if (!g.bitmap.empty())
+                    stbtt_MakeCodepointBitmap(&font_info, g.bitmap.data(), g.width, g.height, g.width, scale, scale, ch);
+            }
+            cache_index[ch] = cache.begin();
+        }
+
+        const auto& g = cache.front();
+        if (g.missing)
+            return GetAtlasGlyph(ReplacementCodepoint, 0);
+        return Glyph{g.height, g.width, g.x0, g.y0, g.advance, g.bitmap};
+    }
+
+    namespace {
+        // Picks the glyph variant nearest to the fixed point pen position and
+        // returns it along with the column its origin is at
+        std::pair<Glyph, int> PlaceGlyph(Font& font, const char32_t ch, const int pen)
+        {
+            const auto bits = font.GetSubpixelBits();
+            const auto step = (pen + (FixedOne >> (bits + 1))) >> (FixedShift - bits);
+            return { font.GetGlyph(ch, step & ((1 << bits) - 1)), step >> bits };
         }
-        return g;
     }
 
     void DrawText(PixelBuffer& pb, Font& font, const Point& p, const Colour& colour, std::string_view text)
     {
-        Point current{p};
-        const auto baseline = font.GetBaseLine();
-        for (const auto ch : text) {
-            const auto& glyph = font.GetGlyph(ch);
+        DrawText(pb, font, p, colour, text, pb.GetClip());
+    }
+
+    void DrawText(PixelBuffer& pb, Font& font, const Point& p, const Colour& colour, std::string_view text, const Rectangle& clip)
+    {
+        const auto clip_right = clip.point.x + clip.size.width;
+        const auto clip_bottom = clip.point.y + clip.size.height;
+        const auto baseline = p.y + font.GetBaseLine();
+        int pen = p.x * FixedOne;
+        char32_t previous = 0;
+        for (auto rest = text; !rest.empty();) {
+            const auto ch = util::NextCodepoint(rest);
+            pen += font.GetKerning(previous, ch);
+            previous = ch;
 
-            const Point renderPoint{current + Point{0, baseline + glyph.y0}};
-            for (int y = 0; y < glyph.height; ++y) {
-                for (int x = 0; x < glyph.width; ++x) {
-                    const auto v = glyph.bitmap[y * glyph.width + x] / 255.0;
-                    const auto currentPixel = pb.GetPixel(renderPoint + Point{x, y});
+            const auto [ glyph, x ] = PlaceGlyph(font, ch, pen);
+            const Point renderPoint{x + glyph.x0, baseline + glyph.y0};
+            if (renderPoint.x >= clip_right)
+                break;
+            // Whole glyphs outside the clip are skipped, the rest is clipped once
+            if (renderPoint.x + glyph.width > clip.point.x && renderPoint.y + glyph.height > clip.point.y && renderPoint.y < clip_bottom)
+                pb.BlendMask(renderPoint, Size{glyph.width, glyph.height}, glyph.bitmap.data(), glyph.width, colour, clip);
+            pen += glyph.advance;
+        }
+    }
 
-                    const auto scaledColour = Blend(currentPixel, colour, v);
-                    pb.PutPixel(renderPoint + Point{x, y}, scaledColour);
+    int GetTextWidth(Font& font, std::string_view text) {
+        int pen = 0;
+        char32_t previous = 0;
+        for (auto rest = text; !rest.empty();) {
+            const auto ch = util::NextCodepoint(rest);
+            pen += font.GetKerning(previous, ch) + font.GetAdvance(ch);
+            previous = ch;
+        }
+        return (pen + FixedOne / 2) >> FixedShift;
+    }
+
+    void DrawText(PixelBuffer& pb, const SdfFont& font, const Point& p, const Colour& colour, std::string_view text, const float size)
+    {
+        const auto factor = size / SdfFont::BaseSize;
+        const auto inverse = 1.0f / factor;
+        const auto step = static_cast<int>(inverse * 65536);
+        // One pixel at the target size spans this much of the field
+        const auto gain = std::max<int>(std::lround(factor * 255 / SdfFont::PixelDistScale * 64), 1);
+        const auto& bounds = pb.GetClip();
+        const auto baseline = p.y + font.GetAscent() * factor;
+
+        struct Column { int x0, x1, weight; };
+        std::vector<Column> columns;
+        std::vector<uint8_t> distance, coverage;
+        int pen = 0; // fixed point, at BaseSize
+        char32_t previous = 0;
+        for (auto rest = text; !rest.empty();) {
+            const auto ch = util::NextCodepoint(rest);
+            pen += font.GetKerning(previous, ch);
+            previous = ch;
+            const auto glyph = font.GetGlyph(ch);
+            const auto glyph_x = p.x + (static_cast<float>(pen) / FixedOne + glyph.x0) * factor;
+            const auto glyph_y = baseline + glyph.y0 * factor;
+            pen += glyph.advance;
+            if (glyph.width == 0)
+                continue;
+
+            // Scale the field into the pixels the glyph touches, keeping the
+            // fractional part of its position
+            const Point origin{static_cast<int>(std::floor(glyph_x)), static_cast<int>(std::floor(glyph_y))};
+            const auto frac_x = glyph_x - origin.x, frac_y = glyph_y - origin.y;
+            const Size scaled{static_cast<int>(std::ceil(glyph.width * factor + frac_x)), static_cast<int>(std::ceil(glyph.height * factor + frac_y))};
+            if (origin.x >= bounds.point.x + bounds.size.width)
+                break;
+            const auto visible = ClipTo(Rectangle{origin, scaled}, bounds);
+            if (visible.size.width <= 0 || visible.size.height <= 0)
+                continue;
+
+            // Bilinear sampling in 16.16 fixed point, clamped to the field;
+            // the columns are the same for every row
+            distance.resize(scaled.width);
+            columns.resize(scaled.width);
+            auto source_x = static_cast<int>(std::lround(((0.5f - frac_x) * inverse - 0.5f) * 65536));
+            for (auto& column : columns) {
+                column.x0 = std::clamp(source_x >> 16, 0, glyph.width - 1);
+                column.x1 = std::clamp((source_x >> 16) + 1, 0, glyph.width - 1);
+                column.weight = (source_x >> 8) & 0xff;
+                source_x += step;
+            }
+            coverage.resize(scaled.width * visible.size.height);
+            const auto first_row = visible.point.y - origin.y;
+            for (int y = 0; y < visible.size.height; ++y) {
+                const auto source_y = static_cast<int>(std::lround(((first_row + y + 0.5f - frac_y) * inverse - 0.5f) * 65536));
+                const auto row0 = &glyph.bitmap[std::clamp(source_y >> 16, 0, glyph.height - 1) * glyph.width];
+                const auto row1 = &glyph.bitmap[std::clamp((source_y >> 16) + 1, 0, glyph.height - 1) * glyph.width];
+                const auto wy = (source_y >> 8) & 0xff;
+                for (int x = 0; x < scaled.width; ++x) {
+                    const auto& c = columns[x];
+                    const auto upper = row0[c.x0] * (256 - c.weight) + row0[c.x1] * c.weight;
+                    const auto lower = row1[c.x0] * (256 - c.weight) + row1[c.x1] * c.weight;
+                    distance[x] = (upper * (256 - wy) + lower * wy) >> 16;
                 }
+                blend::DistanceToCoverage(&coverage[y * scaled.width], distance.data(), gain, scaled.width);
             }
-            current.x += glyph.advance * font.GetScale();
+            pb.BlendMask({origin.x, visible.point.y}, {scaled.width, visible.size.height}, coverage.data(), scaled.width, colour);
         }
     }
 
-    int GetTextWidth(Font& font, std::string_view text) {
-        int width = 0;
-        for (const auto ch : text) {
-            const auto& glyph = font.GetGlyph(ch);
-            width += glyph.advance * font.GetScale();
+    int GetTextWidth(const SdfFont& font, std::string_view text, const float size)
+    {
+        int pen = 0;
+        char32_t previous = 0;
+        for (auto rest = text; !rest.empty();) {
+            const auto ch = util::NextCodepoint(rest);
+            pen += font.GetKerning(previous, ch) + font.GetGlyph(ch).advance;
+            previous = ch;
         }
-        return width;
+        return std::lround(static_cast<float>(pen) / FixedOne * size / SdfFont::BaseSize);
     }
-}
 
+    Coverage RenderText(Font& font, std::string_view text)
+    {
+        // Determine the extent of all glyphs first, which may stick out of
+        // the advance and above the ascent
+        const auto baseline = font.GetBaseLine();
+        int left = 0, top = 0, right = 0, bottom = 0, pen = 0;
+        char32_t previous = 0;
+        for (auto rest = text; !rest.empty();) {
+            const auto ch = util::NextCodepoint(rest);
+            pen += font.GetKerning(previous, ch);
+            previous = ch;
+            const auto [ glyph, x ] = PlaceGlyph(font, ch, pen);
+            left = std::min(left, x + glyph.x0);
+            top = std::min(top, baseline + glyph.y0);
+            right = std::max(right, x + glyph.x0 + glyph.width);
+            bottom = std::max(bottom, baseline + glyph.y0 + glyph.height);
+            pen += glyph.advance;
+        }
+
+        Coverage result;
+        result.offset = Point{left, top};
+        result.size = Size{right - left, bottom - top};
+        result.mask.resize(result.size.width * result.size.height);
+
+        pen = 0;
+        previous = 0;
+        for (auto rest = text; !rest.empty();) {
+            const auto ch = util::NextCodepoint(rest);
+            pen += font.GetKerning(previous, ch);
+            previous = ch;
+            const auto [ glyph, x ] = PlaceGlyph(font, ch, pen);
+            const auto dest_x = x + glyph.x0 - left;
+            const auto dest_y = baseline + glyph.y0 - top;
+            for (int row = 0; row < glyph.height; ++row) {
+                const auto source = &glyph.bitmap[row * glyph.width];
+                const auto dest = &result.mask[(dest_y + row) * result.size.width + dest_x];
+                for (int column = 0; column < glyph.width; ++column)
+                    dest[column] = std::max(dest[column], source[column]);
+            }
+            pen += glyph.advance;
+        }
+        return result;
+    }
+
+    void DrawCoverage(PixelBuffer& pb, const Coverage& coverage, const Point& p, const Colour& colour)
+    {
+        pb.BlendMask(p + coverage.offset, coverage.size, coverage.mask.data(), coverage.size.width, colour);
+    }
+}
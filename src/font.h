@@ -4,42 +4,226 @@
  * Copyright (c) 2023 Rink Springer <rink@rink.nu>
  * For conditions of distribution and use, see LICENSE file
  */
+#pragma once
+
 #include <cstdint>
-#include <array>
+#include <list>
+#include <memory>
 #include <span>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 #include "../3rdparty/stb/stb_truetype.h"
+#include "types.h"
+#include "util.h"
 
-struct Point;
-struct Colour;
 struct PixelBuffer;
 
 namespace font {
 
+// Pen positions and advances are in pixels with FixedShift fractional bits
+constexpr inline int FixedShift = 8;
+constexpr inline int FixedOne = 1 << FixedShift;
+
 struct Glyph
 {
-    int height{}, width{}, y0{}, advance{};
-    std::span<std::uint8_t> bitmap;
+    int height{}, width{}, x0{}, y0{};
+    // Fixed point, see FixedShift
+    int advance{};
+    std::span<const std::uint8_t> bitmap;
+};
+
+struct CacheStatistics
+{
+    std::uint64_t hits{}, misses{}, evictions{};
+};
+
+enum class Positioning {
+    // Glyphs start at whole pixels
+    Pixel,
+    // Glyphs are rasterized at four horizontal offsets within a pixel
+    QuarterPixel
 };
 
 class Font
 {
-    std::array<Glyph, 256> glyph;
+public:
+    // Glyphs in this range are rasterized up front; anything else is
+    // rasterized on demand and kept in a cache of limited size
+    static constexpr inline char32_t FirstCodepoint = 32;
+    static constexpr inline char32_t LastCodepoint = 126;
+    // Drawn for codepoints the font does not have
+    static constexpr inline char32_t ReplacementCodepoint = '?';
+    static constexpr inline size_t DefaultCacheCapacity = 256;
+
+private:
+    // log2 of the number of variants per atlas glyph
+    const int subpixel_bits;
+
+    // The atlas and metrics of the glyphs in range, as produced by Bake();
+    // they are either in baked or in baked_file
+    std::vector<std::byte> baked;
+    std::unique_ptr<util::MappedFile> baked_file;
+
+    // All glyph bitmaps, back to back; each has a stride of its width
+    std::span<const std::uint8_t> atlas;
+    // Glyph layout, indexed by (codepoint - FirstCodepoint) << subpixel_bits | variant
+    std::span<const std::uint32_t> glyph_offset;
+    std::span<const std::uint16_t> glyph_width;
+    std::span<const std::uint16_t> glyph_height;
+    std::span<const std::int16_t> glyph_x0;
+    std::span<const std::int16_t> glyph_y0;
+    // Indexed by codepoint - FirstCodepoint, fixed point
+    std::span<const std::int32_t> glyph_advance;
+
+    // Kerning between atlas glyphs; the pairs starting with codepoint c are
+    // at [kern_index[c - FirstCodepoint], kern_index[c - FirstCodepoint + 1])
+    // sorted by second codepoint
+    std::span<const std::uint16_t> kern_index;
+    std::span<const std::uint8_t> kern_second;
+    std::span<const std::int16_t> kern_amount;
+
+    struct CachedGlyph
+    {
+        char32_t codepoint{};
+        bool missing{};
+        int height{}, width{}, x0{}, y0{}, advance{};
+        std::vector<std::uint8_t> bitmap;
+    };
+    // Most recently used glyph first
+    std::list<CachedGlyph> cache;
+    std::unordered_map<char32_t, std::list<CachedGlyph>::iterator> cache_index;
+    const size_t cache_capacity;
+    CacheStatistics cache_statistics;
+
     float scale;
     int baseline;
     stbtt_fontinfo font_info;
     std::vector<std::byte> font_data;
 
+    bool Attach(std::span<const std::byte> image, const int font_size);
+    Glyph GetAtlasGlyph(const char32_t ch, const int variant) const
+    {
+        const auto n = (ch - FirstCodepoint) << subpixel_bits | variant;
+        const auto offset = glyph_offset[n];
+        const auto size = glyph_width[n] * glyph_height[n];
+        return Glyph{glyph_height[n], glyph_width[n], glyph_x0[n], glyph_y0[n], glyph_advance[ch - FirstCodepoint],
+            {atlas.data() + offset, atlas.data() + offset + size}};
+    }
+    Glyph GetCachedGlyph(const char32_t ch);
+
 public:
-    Font(std::vector<std::byte> data, const int font_size);
+    Font(std::vector<std::byte> data, const int font_size, const Positioning positioning = Positioning::Pixel,
+        const size_t cache_capacity = DefaultCacheCapacity);
+    // Takes the glyphs from baked_path, as written by fontbake, unless it
+    // is missing or does not match the other arguments
+    Font(std::vector<std::byte> data, const int font_size, const Positioning positioning, const char* baked_path,
+        const size_t cache_capacity = DefaultCacheCapacity);
+
+    Font(const Font&) = delete;
+    Font& operator=(const Font&) = delete;
 
     const auto GetScale() const { return scale; }
     const auto GetBaseLine() const { return baseline; }
-    const Glyph& GetGlyph(const int ch);
+    const auto GetSubpixelBits() const { return subpixel_bits; }
+    const auto& GetCacheStatistics() const { return cache_statistics; }
+
+    // Fixed point
+    int GetAdvance(const char32_t ch)
+    {
+        if (ch >= FirstCodepoint && ch <= LastCodepoint)
+            return glyph_advance[ch - FirstCodepoint];
+        return GetCachedGlyph(ch).advance;
+    }
+    // Fixed point; only pairs within the atlas are kerned
+    int GetKerning(const char32_t first, const char32_t second) const;
+
+    // The bitmap of a glyph outside the atlas stays valid until the next
+    // call for another such glyph. variant selects the subpixel offset in
+    // steps of 1 / (1 << GetSubpixelBits()) pixel; glyphs outside the atlas
+    // only have the first
+    Glyph GetGlyph(const char32_t ch, const int variant = 0)
+    {
+        if (ch >= FirstCodepoint && ch <= LastCodepoint)
+            return GetAtlasGlyph(ch, variant);
+        return GetCachedGlyph(ch);
+    }
+};
+
+// Glyphs of the atlas range as signed distance fields at a single size, from
+// which text of any size can be drawn. Other codepoints are drawn as the
+// replacement
+class SdfFont
+{
+public:
+    // Size the fields are generated at
+    static constexpr inline int BaseSize = 48;
+    // Distance in pixels at BaseSize that the field covers beyond an edge
+    static constexpr inline int Padding = 5;
+    static constexpr inline int OnEdge = 128;
+    static constexpr inline float PixelDistScale = static_cast<float>(OnEdge) / Padding;
+
+private:
+    std::vector<std::uint8_t> atlas;
+    // Indexed by codepoint - Font::FirstCodepoint; all at BaseSize
+    std::vector<std::uint32_t> glyph_offset;
+    std::vector<std::uint16_t> glyph_width;
+    std::vector<std::uint16_t> glyph_height;
+    std::vector<std::int16_t> glyph_x0;
+    std::vector<std::int16_t> glyph_y0;
+    std::vector<std::int32_t> glyph_advance;
+    // As with Font, at BaseSize
+    std::vector<std::uint16_t> kern_index;
+    std::vector<std::uint8_t> kern_second;
+    std::vector<std::int16_t> kern_amount;
+    float ascent;
+
+public:
+    SdfFont(std::span<const std::byte> data);
+
+    SdfFont(const SdfFont&) = delete;
+    SdfFont& operator=(const SdfFont&) = delete;
+
+    // In pixels at BaseSize
+    float GetAscent() const { return ascent; }
+    // Fixed point, at BaseSize
+    int GetKerning(const char32_t first, const char32_t second) const;
+    // The bitmap holds the distance field, at BaseSize
+    Glyph GetGlyph(char32_t ch) const
+    {
+        if (ch < Font::FirstCodepoint || ch > Font::LastCodepoint)
+            ch = Font::ReplacementCodepoint;
+        const auto n = ch - Font::FirstCodepoint;
+        const auto offset = glyph_offset[n];
+        const auto size = glyph_width[n] * glyph_height[n];
+        return Glyph{glyph_height[n], glyph_width[n], glyph_x0[n], glyph_y0[n], glyph_advance[n],
+            {atlas.data() + offset, atlas.data() + offset + size}};
+    }
+};
+
+// Rasterizes and lays out the glyphs in the atlas range, along with their
+// metrics and kerning, into a single image that Font can use as is
+std::vector<std::byte> Bake(std::span<const std::byte> data, const int font_size, const Positioning positioning);
+
+// Text rendered to 8-bit coverage once, so that it can be blended often
+struct Coverage
+{
+    // Top-left corner relative to the point the text is drawn at
+    Point offset;
+    Size size;
+    std::vector<std::uint8_t> mask;
 };
 
 void DrawText(PixelBuffer& pb, Font& font, const Point& p, const Colour& colour, std::string_view text);
+// Only the glyphs that intersect clip are drawn
+void DrawText(PixelBuffer& pb, Font& font, const Point& p, const Colour& colour, std::string_view text, const Rectangle& clip);
 int GetTextWidth(Font& font, std::string_view text);
 
+// Draws text of the given pixel height; the size need not be whole
+void DrawText(PixelBuffer& pb, const SdfFont& font, const Point& p, const Colour& colour, std::string_view text, const float size);
+int GetTextWidth(const SdfFont& font, std::string_view text, const float size);
+
+Coverage RenderText(Font& font, std::string_view text);
+void DrawCoverage(PixelBuffer& pb, const Coverage& coverage, const Point& p, const Colour& colour);
+
 }
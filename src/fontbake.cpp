@@ -0,0 +1,58 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include "font.h"
+#include "util.h"
+
+// Bakes the atlas of a font at a given size into a file that font::Font can
+// map at startup instead of rasterizing the glyphs itself
+int main(int argc, char* argv[])
+{
+    if (argc != 5) {
+        std::cerr << "usage: " << argv[0] << " font.ttf size pixel|quarter output.glyphs\n";
+        return 1;
+    }
+
+    const std::string_view size_arg{argv[2]};
+    int size{};
+    if (const auto [ ptr, ec ] = std::from_chars(size_arg.data(), size_arg.data() + size_arg.size(), size);
+        ec != std::errc{} || ptr != size_arg.data() + size_arg.size() || size <= 0) {
+        std::cerr << "invalid size '" << size_arg << "'\n";
+        return 1;
+    }
+
+    const std::string_view positioning_arg{argv[3]};
+    font::Positioning positioning;
+    if (positioning_arg == "pixel") {
+        positioning = font::Positioning::Pixel;
+    } else if (positioning_arg == "quarter") {
+        positioning = font::Positioning::QuarterPixel;
+    } else {
+        std::cerr << "invalid positioning '" << positioning_arg << "'\n";
+        return 1;
+    }
+
+    try {
+        const auto image = font::Bake(util::ReadFile(argv[1]), size, positioning);
+        // Write under a temporary name so that an interrupted run never
+        // leaves a truncated file behind
+        const auto temp_path = std::string(argv[4]) + ".tmp";
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(image.data()), image.size());
+        out.close();
+        if (!out || std::rename(temp_path.c_str(), argv[4]) != 0)
+            throw std::runtime_error("cannot write output");
+    } catch (std::exception& e) {
+        std::cerr << argv[1] << ": " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
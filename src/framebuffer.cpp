@@ -5,43 +5,552 @@
  * For conditions of distribution and use, see LICENSE file
  */
 #include "framebuffer.h"
-#include <linux/fb.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <cstddef>
 #include <cstring>
 #include <fcntl.h>
+#include <stdexcept>
 #include "pixelbuffer.h"
+#include "spdlog/spdlog.h"
 
-FrameBuffer::FrameBuffer(const char* path)
+namespace {
+
+bool WriteAll(int fd, const void* data, size_t length)
+{
+    auto p = static_cast<const uint8_t*>(data);
+    while (length > 0) {
+        const auto n = write(fd, p, length);
+        if (n <= 0)
+            return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool EndsWith(std::string_view s, std::string_view suffix)
+{
+    return s.size() >= suffix.size() && s.substr(s.size() - suffix.size()) == suffix;
+}
+
+}
+
+FrameBuffer::FrameBuffer(const FrameBufferOptions& options)
+    : backend(options.backend), path(options.path), dither(options.dither)
+    , rotation(options.rotation), mirror(options.mirror)
+{
+    if (backend == Backend::Device) {
+        OpenDevice(options);
+    } else {
+        if (options.bits_per_pixel != 32 && options.bits_per_pixel != 16)
+            throw std::runtime_error("unsupported bpp");
+        if (options.size.width <= 0 || options.size.height <= 0)
+            throw std::runtime_error("invalid framebuffer size");
+        size = options.size;
+        bytes_per_pixel = options.bits_per_pixel / 8;
+        stride = size.width * bytes_per_pixel;
+        memory_size = stride * size.height;
+        if (backend == Backend::SharedMemory) {
+            OpenSharedMemory();
+        } else {
+            storage = std::make_unique<uint8_t[]>(memory_size);
+            memory = storage.get();
+        }
+        if (backend == Backend::Dump) {
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                throw std::runtime_error("cannot create dump file");
+        }
+    }
+
+    // Size of the framebuffer before rotating
+    const auto logical_size = IsTransposing() ? Size{size.height, size.width} : size;
+    switch (rotation) {
+        case rotate::Rotation::None:
+            reverse_rows = mirror;
+            break;
+        case rotate::Rotation::Degrees90:
+            // Framebuffer rows are rendered columns, bottom up
+            flip_rows = mirror;
+            reverse_rows = true;
+            break;
+        case rotate::Rotation::Degrees180:
+            flip_rows = true;
+            reverse_rows = !mirror;
+            break;
+        case rotate::Rotation::Degrees270:
+            flip_rows = !mirror;
+            break;
+    }
+    oriented_row.resize(size.width);
+
+    auto render_size = logical_size;
+    if (options.render_size != Size{} && options.render_size != logical_size) {
+        if (options.render_size.width <= 0 || options.render_size.height <= 0 ||
+            options.render_size.width > logical_size.width || options.render_size.height > logical_size.height)
+            throw std::runtime_error("invalid render size");
+        render_size = options.render_size;
+        // When rotating by 90 or 270 degrees, rows are scaled once transposed
+        const auto from = IsTransposing() ? Size{render_size.height, render_size.width} : render_size;
+        scaler.emplace(from, size, options.filter);
+        scaled_row.resize(size.width);
+    }
+    if (IsTransposing())
+        columns.resize(render_size.width * render_size.height);
+
+    direct = options.render_in_place && !scaler && rotation == rotate::Rotation::None && !mirror &&
+        pages > 1 && bytes_per_pixel == 4 && stride == size.width * 4;
+    if (direct) {
+        back_page = 1;
+        pixel_buffer = std::make_unique<PixelBuffer>(size, reinterpret_cast<PixelValue*>(GetPage(back_page)));
+        front_stale = DamageMap(size.height);
+        front_stale.Add(Rectangle{{}, size});
+    } else {
+        pixel_buffer = std::make_unique<PixelBuffer>(render_size);
+        if (pages > 1)
+            back_page = 1;
+    }
+    // These are in pixel buffer coordinates
+    previous_changes = DamageMap(render_size.height);
+    changes = DamageMap(render_size.height);
+    transposed = DamageMap(render_size.height);
+    // Whatever the framebuffer holds now is unrelated to what we render
+    previous_changes.Add(Rectangle{{}, render_size});
+}
+
+FrameBuffer::~FrameBuffer()
 {
-    fd = open(path, O_RDWR);
+    switch (backend) {
+        case Backend::Device:
+            munmap(memory, memory_size);
+            if (pages > 1) {
+                var_info.yoffset = 0;
+                var_info.yres_virtual = original_yres_virtual;
+                ioctl(fd, FBIOPUT_VSCREENINFO, &var_info);
+            }
+            break;
+        case Backend::SharedMemory:
+            munmap(memory, memory_size);
+            shm_unlink(path.c_str());
+            break;
+        default:
+            break;
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+void FrameBuffer::OpenDevice(const FrameBufferOptions& options)
+{
+    fd = open(path.c_str(), O_RDWR);
     if (fd < 0)
         throw std::runtime_error("cannot open framebuffer");
 
-    struct fb_var_screeninfo si;
-    if (ioctl(fd, FBIOGET_VSCREENINFO, &si) < 0)
+    if (ioctl(fd, FBIOGET_VSCREENINFO, &var_info) < 0)
+        throw std::runtime_error("cannot query framebuffer info");
+
+    switch (var_info.bits_per_pixel) {
+        case 32:
+            break;
+        case 16:
+            if (var_info.green.offset != 5 || var_info.green.length != 6 ||
+                var_info.red.length != 5 || var_info.blue.length != 5)
+                throw std::runtime_error("unsupported 16bpp pixel layout");
+            layout.red_shift = var_info.red.offset;
+            layout.blue_shift = var_info.blue.offset;
+            break;
+        default:
+            throw std::runtime_error("unsupported bpp");
+    }
+    bytes_per_pixel = var_info.bits_per_pixel / 8;
+    size.width = var_info.xres;
+    size.height = var_info.yres;
+    original_yres_virtual = var_info.yres_virtual;
+
+    struct fb_fix_screeninfo fix_info;
+    if (ioctl(fd, FBIOGET_FSCREENINFO, &fix_info) < 0)
         throw std::runtime_error("cannot query framebuffer info");
+    stride = fix_info.line_length;
 
-    if (si.bits_per_pixel != 32)
-        throw std::runtime_error("unsupported bpp");
-    size.width = si.xres;
-    size.height = si.yres;
+    if (options.page_flip && !EnablePageFlipping())
+        spdlog::warn("framebuffer does not support page flipping, falling back to copying");
 
-    auto fb = mmap(NULL, size.width * size.height * 4, PROT_WRITE, MAP_SHARED, fd, 0);
+    memory_size = pages * stride * size.height;
+    auto fb = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     if (fb == MAP_FAILED)
         throw std::runtime_error("unable to map framebuffer");
-    memory = reinterpret_cast<uint32_t*>(fb);
+    memory = reinterpret_cast<uint8_t*>(fb);
+
+    if (pages > 1 && !Pan(0)) {
+        spdlog::warn("framebuffer cannot pan, falling back to copying");
+        var_info.yres_virtual = original_yres_virtual;
+        ioctl(fd, FBIOPUT_VSCREENINFO, &var_info);
+        pages = 1;
+    }
 }
 
-FrameBuffer::~FrameBuffer()
+void FrameBuffer::OpenSharedMemory()
+{
+    const auto shm_fd = shm_open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (shm_fd < 0)
+        throw std::runtime_error("cannot open shared memory");
+
+    struct DerefClose {
+        ~DerefClose() { close(fd); }
+        int fd;
+    } dc{shm_fd};
+
+    if (ftruncate(shm_fd, memory_size) < 0)
+        throw std::runtime_error("cannot resize shared memory");
+    auto p = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("unable to map shared memory");
+    memory = reinterpret_cast<uint8_t*>(p);
+}
+
+bool FrameBuffer::EnablePageFlipping()
+{
+    auto si = var_info;
+    si.yres_virtual = si.yres * 2;
+    si.yoffset = 0;
+    if (ioctl(fd, FBIOPUT_VSCREENINFO, &si) < 0)
+        return false;
+
+    // Drivers may silently adjust the request rather than reject it
+    if (ioctl(fd, FBIOGET_VSCREENINFO, &si) < 0 || si.yres_virtual < si.yres * 2 ||
+        si.bits_per_pixel != var_info.bits_per_pixel || si.xres != var_info.xres || si.yres != var_info.yres) {
+        ioctl(fd, FBIOPUT_VSCREENINFO, &var_info);
+        return false;
+    }
+
+    struct fb_fix_screeninfo fi;
+    if (ioctl(fd, FBIOGET_FSCREENINFO, &fi) < 0 || fi.smem_len < 2 * fi.line_length * si.yres) {
+        ioctl(fd, FBIOPUT_VSCREENINFO, &var_info);
+        return false;
+    }
+
+    var_info = si;
+    stride = fi.line_length;
+    pages = 2;
+    return true;
+}
+
+bool FrameBuffer::Pan(int page)
+{
+    var_info.xoffset = 0;
+    var_info.yoffset = page * size.height;
+    return ioctl(fd, FBIOPAN_DISPLAY, &var_info) == 0;
+}
+
+void FrameBuffer::Flip(PixelBuffer& pb)
+{
+    Pan(back_page);
+    back_page ^= 1;
+    pb.buffer = reinterpret_cast<PixelValue*>(GetPage(back_page));
+
+    // What was just drawn is left behind on the page now shown, and the new
+    // back page still holds the frame before
+    std::swap(pb.stale, front_stale);
+    std::swap(front_stale, pb.damage);
+    pb.damage.Reset();
+}
+
+void FrameBuffer::WritePixels(uint8_t* page, int x, int y, const PixelValue* source, int count)
+{
+    const auto dest = page + y * stride + x * bytes_per_pixel;
+    if (bytes_per_pixel == 4) {
+        memcpy(dest, source, count * 4);
+    } else if (dither) {
+        convert::ToRGB565Dithered(reinterpret_cast<uint16_t*>(dest), source, count, x, y, layout);
+    } else {
+        convert::ToRGB565(reinterpret_cast<uint16_t*>(dest), source, count, layout);
+    }
+}
+
+// Writes a row as rendered, or as transposed when rotating by 90 or 270
+// degrees
+void FrameBuffer::WriteRow(uint8_t* page, int x, int y, const PixelValue* source, int count)
+{
+    if (flip_rows)
+        y = size.height - 1 - y;
+    if (reverse_rows) {
+        rotate::Reverse(oriented_row.data(), source, count);
+        WritePixels(page, size.width - x - count, y, oriented_row.data(), count);
+        return;
+    }
+    WritePixels(page, x, y, source, count);
+}
+
+void FrameBuffer::WriteSpan(uint8_t* page, const PixelBuffer& pb, int y, const Span& span)
+{
+    if (IsTransposing()) {
+        // Written as a whole once all rows are known
+        transposed.Add(y, span.x0, span.x1);
+    } else if (scaler) {
+        WriteScaledSpan(page, pb.buffer, y, span);
+    } else {
+        WriteRow(page, span.x0, y, &pb.buffer[y * pb.GetSize().width + span.x0], span.x1 - span.x0);
+    }
+}
+
+// Writes every pixel that the span of source row y is the nearest source
+// pixel of
+void FrameBuffer::WriteScaledSpan(uint8_t* page, const PixelValue* source, int y, const Span& span)
+{
+    const auto x0 = scaler->MapX(span.x0);
+    const auto x1 = scaler->MapX(span.x1);
+    const auto y0 = scaler->MapY(y);
+    const auto y1 = scaler->MapY(y + 1);
+    const auto nearest = scaler->GetFilter() == scale::Filter::Nearest;
+    for (int dy = y0; dy < y1; ++dy) {
+        // With nearest neighbour scaling, all these rows are the same
+        if (!nearest || dy == y0)
+            scaler->Row(scaled_row.data(), source, dy, x0, x1);
+        WriteRow(page, x0, dy, scaled_row.data(), x1 - x0);
+    }
+}
+
+// Rows turn into columns: the rendered columns of the changed rows are
+// copied into rows of columns a pixel at a time, then written like any other
+// row. This goes a strip of columns as wide as a cache line at a time, so
+// that every row read is used whole
+void FrameBuffer::WriteTransposed(uint8_t* page, const PixelBuffer& pb)
+{
+    if (transposed.Empty())
+        return;
+
+    constexpr int Strip = 64 / sizeof(PixelValue);
+    const auto width = pb.GetSize().width;
+    const auto height = pb.GetSize().height;
+    const auto top = transposed.GetTop();
+    const auto bottom = transposed.GetBottom();
+    Span hull;
+    for (int y = top; y < bottom; ++y)
+        hull = Hull(hull, transposed.GetRow(y));
+
+    const auto write = [&](int x) {
+        if (scaler)
+            WriteScaledSpan(page, columns.data(), x, Span{top, bottom});
+        else
+            WriteRow(page, top, x, &columns[x * height + top], bottom - top);
+    };
+    // Bilinear scaling reads the next column as well, so then columns are
+    // only written once all are gathered
+    const auto bilinear = scaler && scaler->GetFilter() == scale::Filter::Bilinear;
+    const PixelValue* source = pb.buffer;
+    for (int x0 = hull.x0; x0 < hull.x1; x0 += Strip) {
+        const auto x1 = std::min(x0 + Strip, hull.x1);
+        for (int y = top; y < bottom; ++y) {
+            for (int x = x0; x < x1; ++x)
+                columns[x * height + y] = source[y * width + x];
+        }
+        for (int x = x0; !bilinear && x < x1; ++x)
+            write(x);
+    }
+    for (int x = hull.x0; bilinear && x < hull.x1; ++x)
+        write(x);
+    transposed.Reset();
+}
+
+void FrameBuffer::Dump()
+{
+    if (!EndsWith(path, ".ppm")) {
+        if (!WriteAll(fd, memory, memory_size))
+            throw std::runtime_error("cannot write dump file");
+        return;
+    }
+
+    const auto header = "P6\n" + std::to_string(size.width) + " " + std::to_string(size.height) + "\n255\n";
+    dump_buffer.resize(header.size() + size.width * size.height * 3);
+    std::copy(header.begin(), header.end(), dump_buffer.begin());
+    auto out = dump_buffer.data() + header.size();
+    for (int y = 0; y < size.height; ++y) {
+        for (int x = 0; x < size.width; ++x) {
+            int r, g, b;
+            if (bytes_per_pixel == 4) {
+                const auto v = reinterpret_cast<const PixelValue*>(memory + y * stride)[x];
+                r = (v >> 16) & 0xff;
+                g = (v >> 8) & 0xff;
+                b = v & 0xff;
+            } else {
+                const auto v = reinterpret_cast<const uint16_t*>(memory + y * stride)[x];
+                r = (v >> layout.red_shift) & 0x1f;
+                g = (v >> 5) & 0x3f;
+                b = (v >> layout.blue_shift) & 0x1f;
+                r = r << 3 | r >> 2;
+                g = g << 2 | g >> 4;
+                b = b << 3 | b >> 2;
+            }
+            *out++ = r;
+            *out++ = g;
+            *out++ = b;
+        }
+    }
+    if (!WriteAll(fd, dump_buffer.data(), dump_buffer.size()))
+        throw std::runtime_error("cannot write dump file");
+}
+
+void FrameBuffer::Render(PixelBuffer& pb)
+{
+    if (direct && &pb == pixel_buffer.get()) {
+        Flip(pb);
+        return;
+    }
+
+    // With two pages, the back page lacks both this frame's and the
+    // previous frame's changes
+    const auto page = GetPage(back_page);
+    const auto height = pb.GetSize().height;
+    const auto pending = [&](int y) {
+        if (y < 0 || y >= height)
+            return Span{};
+        const auto span = Hull(pb.stale.GetRow(y), pb.damage.GetRow(y));
+        return pages > 1 ? Hull(span, previous_changes.GetRow(y)) : span;
+    };
+    // Bilinear filtering mixes in the neighbouring pixels of every change
+    const auto grow = scaler && scaler->GetFilter() == scale::Filter::Bilinear ? 1 : 0;
+
+    auto top = std::min(pb.stale.GetTop(), pb.damage.GetTop());
+    auto bottom = std::max(pb.stale.GetBottom(), pb.damage.GetBottom());
+    if (pages > 1) {
+        top = std::min(top, previous_changes.GetTop());
+        bottom = std::max(bottom, previous_changes.GetBottom());
+    }
+    top = std::max(top - grow, 0);
+    bottom = std::min(bottom + grow, height);
+    for (int y = top; y < bottom; ++y) {
+        if (pages > 1) {
+            const auto span = Hull(pb.stale.GetRow(y), pb.damage.GetRow(y));
+            if (!span.Empty())
+                changes.Add(y, span.x0, span.x1);
+        }
+        auto span = pending(y);
+        if (grow) {
+            span = Hull(Hull(pending(y - 1), span), pending(y + 1));
+            if (!span.Empty())
+                span = Span{std::max(span.x0 - 1, 0), std::min(span.x1 + 1, pb.GetSize().width)};
+        }
+        if (!span.Empty())
+            WriteSpan(page, pb, y, span);
+    }
+    if (IsTransposing())
+        WriteTransposed(page, pb);
+
+    Show();
+    pb.EndFrame();
+}
+
+// Writes pixels [span.x0, span.x1) of row y of ib, unless scaling or rotating
+// by 90 or 270 degrees
+void FrameBuffer::ExpandSpan(uint8_t* page, const IndexedPixelBuffer& ib, int y, const Span& span)
+{
+    const auto source = &ib.buffer[y * ib.GetSize().width + span.x0];
+    const auto count = span.x1 - span.x0;
+    if (rotation == rotate::Rotation::None && !mirror) {
+        // Straight into the framebuffer, without an intermediate row
+        const auto dest = page + y * stride + span.x0 * bytes_per_pixel;
+        if (bytes_per_pixel == 4) {
+            indexed::Expand(reinterpret_cast<PixelValue*>(dest), source, ib.palette.data(), count);
+            return;
+        }
+        if (!dither) {
+            indexed::Expand(reinterpret_cast<uint16_t*>(dest), source, palette16.data(), count);
+            return;
+        }
+    }
+    indexed::Expand(expanded_row.data(), source, ib.palette.data(), count);
+    WriteRow(page, span.x0, y, expanded_row.data(), count);
+}
+
+void FrameBuffer::Render(IndexedPixelBuffer& ib)
+{
+    auto& pb = *pixel_buffer;
+    const auto& render_size = pb.GetSize();
+    if (ib.GetSize() != render_size)
+        throw std::runtime_error("indexed buffer does not match the render size");
+
+    // A new palette recolours every pixel, but only this frame needs to
+    // present them all; ib's damage is left alone, so that the next frame
+    // does not have to clear and present everything again
+    const auto recolour = ib.palette_changed;
+    if (recolour) {
+        if (bytes_per_pixel == 2)
+            convert::ToRGB565(palette16.data(), ib.palette.data(), ib.palette.size(), layout);
+        ib.palette_changed = false;
+    }
+    const auto changed = [&](int y) {
+        return recolour ? Span{0, render_size.width} : Hull(ib.stale.GetRow(y), ib.damage.GetRow(y));
+    };
+
+    auto top = recolour ? 0 : std::min(ib.stale.GetTop(), ib.damage.GetTop());
+    auto bottom = recolour ? render_size.height : std::max(ib.stale.GetBottom(), ib.damage.GetBottom());
+    if (scaler || IsTransposing()) {
+        // Expand into the pixel buffer and present that as usual; it holds
+        // exactly what ib does, so nothing in it is stale
+        pb.stale.Reset();
+        for (int y = top; y < bottom; ++y) {
+            const auto span = changed(y);
+            if (span.Empty())
+                continue;
+            const auto offset = y * render_size.width + span.x0;
+            indexed::Expand(&pb.buffer[offset], &ib.buffer[offset], ib.palette.data(), span.x1 - span.x0);
+            pb.damage.Add(y, span.x0, span.x1);
+        }
+        ib.EndFrame();
+        Render(pb);
+        return;
+    }
+
+    // As in Render(PixelBuffer&), the back page also lacks the previous
+    // frame's changes
+    const auto page = GetPage(back_page);
+    expanded_row.resize(render_size.width);
+    if (pages > 1) {
+        top = std::min(top, previous_changes.GetTop());
+        bottom = std::max(bottom, previous_changes.GetBottom());
+    }
+    for (int y = top; y < bottom; ++y) {
+        auto span = changed(y);
+        if (pages > 1) {
+            if (!span.Empty())
+                changes.Add(y, span.x0, span.x1);
+            span = Hull(span, previous_changes.GetRow(y));
+        }
+        if (!span.Empty())
+            ExpandSpan(page, ib, y, span);
+    }
+    Show();
+    if (direct)
+        pb.buffer = reinterpret_cast<PixelValue*>(GetPage(back_page));
+    ib.EndFrame();
+}
+
+// Displays the back page if there are two, and dumps the frame if needed
+void FrameBuffer::Show()
 {
-    munmap(memory, size.width * size.height * 4);
-    close(fd);
+    if (pages > 1) {
+        Pan(back_page);
+        back_page ^= 1;
+        std::swap(previous_changes, changes);
+        changes.Reset();
+    }
+
+    if (backend == Backend::Dump)
+        Dump();
 }
 
-void FrameBuffer::Render(const PixelBuffer& pb)
+bool FrameBuffer::WaitForVSync()
 {
-    memcpy(memory, pb.buffer.get(), size.width * size.height * 4);
+    if (backend != Backend::Device || !vsync_supported)
+        return false;
+
+    uint32_t crtc = 0;
+    if (ioctl(fd, FBIO_WAITFORVSYNC, &crtc) < 0) {
+        spdlog::warn("framebuffer does not support waiting for vsync");
+        vsync_supported = false;
+        return false;
+    }
+    return true;
 }
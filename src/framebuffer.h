@@ -6,22 +6,138 @@
  */
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <linux/fb.h>
+#include "convert.h"
+#include "indexed.h"
+#include "scale.h"
 #include "types.h"
+#include "pixelbuffer.h"
+#include "rotate.h"
 
-struct PixelBuffer;
+enum class Backend {
+    // Linux framebuffer device
+    Device,
+    // Plain memory, nothing is displayed
+    Memory,
+    // Every frame is appended to a file; as PPM if it ends in .ppm, raw otherwise
+    Dump,
+    // POSIX shared memory object, for an external viewer
+    SharedMemory,
+};
+
+struct FrameBufferOptions {
+    Backend backend{Backend::Device};
+    // Device node, dump file or shared memory object name
+    std::string path{"/dev/fb0"};
+    // Dimensions and depth of anything but a device, which dictates its own
+    Size size{320, 240};
+    int bits_per_pixel{32};
+    // Render into an off-screen page and flip using FBIOPAN_DISPLAY
+    bool page_flip{true};
+    // When page flipping at 32bpp, draw straight into the off-screen page
+    // instead of copying the changes there. Framebuffer memory is usually
+    // uncached, so this only pays off if drawing hardly reads back what is
+    // already there; blending does
+    bool render_in_place{false};
+    // Use ordered dithering when presenting to a 16bpp framebuffer
+    bool dither{false};
+    // Render at this size and scale up when presenting; empty renders at the
+    // size of the framebuffer
+    Size render_size{};
+    scale::Filter filter{scale::Filter::Nearest};
+    // Applied when presenting, after mirroring left to right if set;
+    // render_size is as rendered, before rotating
+    rotate::Rotation rotation{rotate::Rotation::None};
+    bool mirror{false};
+};
 
 class FrameBuffer {
-    int fd;
-    uint32_t* memory;
+    const Backend backend;
+    std::string path;
+    int fd{-1};
+    uint8_t* memory;
+    size_t memory_size;
+    std::unique_ptr<uint8_t[]> storage;
     Size size;
+    int bytes_per_pixel;
+    int stride;
+    int pages{1};
+    int back_page{};
+    bool direct{};
+    bool dither;
+    bool vsync_supported{true};
+    convert::RGB565Layout layout;
+    struct fb_var_screeninfo var_info;
+    unsigned int original_yres_virtual;
+    std::unique_ptr<PixelBuffer> pixel_buffer;
+    // Set if the pixel buffer is smaller than the framebuffer
+    std::optional<scale::Scaler> scaler;
+    std::vector<PixelValue> scaled_row;
+    const rotate::Rotation rotation;
+    const bool mirror;
+    // Rows are written bottom up and/or right to left; set up from rotation
+    // and mirror
+    bool flip_rows{};
+    bool reverse_rows{};
+    std::vector<PixelValue> oriented_row;
+    // For rotating by 90 or 270 degrees: the rows left to write, and the
+    // pixel buffer with its rows and columns swapped
+    DamageMap transposed{0};
+    std::vector<PixelValue> columns;
+    // Leftovers of earlier frames on the page currently being displayed
+    DamageMap front_stale{0};
+    // What was presented last frame, which the back page does not have yet
+    DamageMap previous_changes{0};
+    DamageMap changes{0};
+    std::vector<uint8_t> dump_buffer;
+    // For presenting an IndexedPixelBuffer: an expanded row, and its
+    // palette converted to 16bpp
+    std::vector<PixelValue> expanded_row;
+    std::array<uint16_t, 256> palette16;
+
+    uint8_t* GetPage(int page) const { return memory + page * stride * size.height; }
+    void OpenDevice(const FrameBufferOptions& options);
+    void OpenSharedMemory();
+    bool EnablePageFlipping();
+    bool Pan(int page);
+    void Flip(PixelBuffer& pb);
+    void WritePixels(uint8_t* page, int x, int y, const PixelValue* source, int count);
+    void WriteSpan(uint8_t* page, const PixelBuffer& pb, int y, const Span& span);
+    void WriteScaledSpan(uint8_t* page, const PixelValue* source, int y, const Span& span);
+    void WriteRow(uint8_t* page, int x, int y, const PixelValue* source, int count);
+    void WriteTransposed(uint8_t* page, const PixelBuffer& pb);
+    void ExpandSpan(uint8_t* page, const IndexedPixelBuffer& ib, int y, const Span& span);
+    void Show();
+    bool IsTransposing() const { return rotation == rotate::Rotation::Degrees90 || rotation == rotate::Rotation::Degrees270; }
+    void Dump();
 public:
-    FrameBuffer(const char* path);
+    FrameBuffer(const FrameBufferOptions& options = {});
     ~FrameBuffer();
 
     FrameBuffer(const FrameBuffer&) = delete;
     FrameBuffer& operator=(const FrameBuffer&) = delete;
 
     auto GetSize() const { return size; }
-    void Render(const PixelBuffer& pb);
+    auto GetRenderSize() const { return pixel_buffer->GetSize(); }
+    bool IsPageFlipping() const { return pages > 1; }
+
+    // Returns the buffer to render into; with render_in_place, when page
+    // flipping at 32bpp without scaling or rotating, this is the off-screen
+    // page itself so Render() does not need to copy anything
+    PixelBuffer& GetPixelBuffer() { return *pixel_buffer; }
+
+    // Only the damaged parts of pb are written; marks them stale afterwards
+    void Render(PixelBuffer& pb);
+    // As above, looking up the palette while writing; ib must be of the
+    // render size. Use either this or GetPixelBuffer(), not both
+    void Render(IndexedPixelBuffer& ib);
+
+    // Blocks until the next vertical blank; returns false if the backend or
+    // driver cannot do this
+    bool WaitForVSync();
 };
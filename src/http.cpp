@@ -226,7 +226,7 @@ void Server::Handle(std::chrono::microseconds timeout)
         auto callback = [&](const int fd, std::string_view location, std::string_view payload) {
             if (location == "/") {
                 std::stringstream ss;
-                ss << "<html><head><title>Party Player</title></head><body>";
+                ss << "<html><head><meta charset=\"utf-8\"><title>Party Player</title></head><body>";
                 ss << "Current track: <b>" << player.GetCurrentTrackInfo() << "</b><br/>\n";
                 ss << "<a href=\"/next\">skip</a>\n";
                 ss << "</body></html>";
@@ -0,0 +1,270 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "indexed.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace indexed {
+
+namespace {
+
+// Only AVX2 can gather from a table; SSE2 and NEON would have to look up
+// each entry on its own, which is no faster than the plain loop
+template<typename Index>
+void Lookup(PixelValue* dest, const Index* source, const PixelValue* table, const int count)
+{
+    int n = 0;
+#if defined(__AVX2__)
+    const auto t = reinterpret_cast<const int*>(table);
+    for (; n + 8 <= count; n += 8) {
+        __m256i i;
+        if constexpr (sizeof(Index) == 1)
+            i = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + n)));
+        else if constexpr (sizeof(Index) == 2)
+            i = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n)));
+        else
+            i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + n));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + n), _mm256_i32gather_epi32(t, i, 4));
+    }
+#endif
+    for (; n < count; ++n)
+        dest[n] = table[source[n]];
+}
+
+}
+
+void Expand(PixelValue* dest, const std::uint8_t* source, const PixelValue* palette, const int count)
+{
+    Lookup(dest, source, palette, count);
+}
+
+void Expand(PixelValue* dest, const std::uint16_t* source, const PixelValue* palette, const int count)
+{
+    Lookup(dest, source, palette, count);
+}
+
+void Expand(PixelValue* dest, const std::uint32_t* source, const PixelValue* palette, const int count)
+{
+    Lookup(dest, source, palette, count);
+}
+
+void Expand(std::uint16_t* dest, const std::uint8_t* source, const std::uint16_t* palette, const int count)
+{
+    for (int n = 0; n < count; ++n)
+        dest[n] = palette[source[n]];
+}
+
+void MaskColumn(std::uint8_t* dest, const std::ptrdiff_t stride, const std::uint8_t* mask, const std::uint8_t first, const int levels, const int count)
+{
+    for (int n = 0; n < count; ++n, dest += stride) {
+        if (mask[n] != 0)
+            *dest = static_cast<std::uint8_t>(first + (mask[n] * levels >> 8));
+    }
+}
+
+std::vector<std::uint8_t> Quantize(const PixelBuffer& image, const std::uint8_t first, const int levels, const PixelValue key, const std::uint8_t key_index)
+{
+    const auto level = [&](int v) { return (v * (levels - 1) + 127) / 255; };
+    const auto& size = image.GetSize();
+    std::vector<std::uint8_t> result(size.width * size.height);
+    for (size_t n = 0; n < result.size(); ++n) {
+        const auto v = image.buffer[n];
+        if (v == key) {
+            result[n] = key_index;
+            continue;
+        }
+        const auto c = FromPixelValue(v);
+        result[n] = static_cast<std::uint8_t>(first + level(c.r) + levels * (level(c.g) + levels * level(c.b)));
+    }
+    return result;
+}
+
+}
+
+namespace {
+
+// Pixels of mask that are zero leave dest alone, all others become first +
+// mask * levels / 256
+void MaskRow(std::uint8_t* dest, const std::uint8_t* mask, const std::uint8_t first, const int levels, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto l = static_cast<uint16_t>(levels);
+    const auto f = vdupq_n_u8(first);
+    for (; n + 16 <= count; n += 16) {
+        const auto m = vld1q_u8(mask + n);
+        const auto lo = vshrn_n_u16(vmulq_n_u16(vmovl_u8(vget_low_u8(m)), l), 8);
+        const auto hi = vshrn_n_u16(vmulq_n_u16(vmovl_u8(vget_high_u8(m)), l), 8);
+        const auto v = vaddq_u8(vcombine_u8(lo, hi), f);
+        vst1q_u8(dest + n, vbslq_u8(vceqq_u8(m, vdupq_n_u8(0)), vld1q_u8(dest + n), v));
+    }
+#elif defined(__SSE2__)
+    const auto zero = _mm_setzero_si128();
+    const auto l = _mm_set1_epi16(static_cast<short>(levels));
+    const auto f = _mm_set1_epi8(static_cast<char>(first));
+    for (; n + 16 <= count; n += 16) {
+        const auto m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + n));
+        const auto lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(m, zero), l), 8);
+        const auto hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(m, zero), l), 8);
+        const auto v = _mm_add_epi8(_mm_packus_epi16(lo, hi), f);
+        const auto keep = _mm_cmpeq_epi8(m, zero);
+        const auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, v)));
+    }
+#endif
+    for (; n < count; ++n) {
+        if (mask[n] != 0)
+            dest[n] = static_cast<std::uint8_t>(first + (mask[n] * levels >> 8));
+    }
+}
+
+// Copies the pixels of source that are not key to dest
+void KeyRow(std::uint8_t* dest, const std::uint8_t* source, const std::uint8_t key, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto k = vdupq_n_u8(key);
+    for (; n + 16 <= count; n += 16) {
+        const auto v = vld1q_u8(source + n);
+        vst1q_u8(dest + n, vbslq_u8(vceqq_u8(v, k), vld1q_u8(dest + n), v));
+    }
+#elif defined(__SSE2__)
+    const auto k = _mm_set1_epi8(static_cast<char>(key));
+    for (; n + 16 <= count; n += 16) {
+        const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n));
+        const auto keep = _mm_cmpeq_epi8(v, k);
+        const auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, v)));
+    }
+#endif
+    for (; n < count; ++n) {
+        if (source[n] != key)
+            dest[n] = source[n];
+    }
+}
+
+}
+
+IndexedPixelBuffer::IndexedPixelBuffer(Size size)
+    : size(std::move(size)), damage(size.height), stale(size.height)
+{
+    storage = std::make_unique<std::uint8_t[]>(size.height * size.width);
+    buffer = storage.get();
+    stale.Add(Rectangle{{}, size});
+}
+
+void IndexedPixelBuffer::SetGradient(int first, int count, const Colour& from, const Colour& to)
+{
+    for (int n = 0; n < count; ++n)
+        palette[first + n] = BlendPixel(from, to, count > 1 ? n * 255 / (count - 1) : 255);
+    palette_changed = true;
+}
+
+void IndexedPixelBuffer::CyclePalette(int first, int count, int steps)
+{
+    if (count <= 0)
+        return;
+    steps %= count;
+    if (steps < 0)
+        steps += count;
+    std::rotate(&palette[first], &palette[first + count - steps], &palette[first + count]);
+    palette_changed = true;
+}
+
+void IndexedPixelBuffer::SetColourCube(int first, int levels)
+{
+    if (levels < 2 || first + levels * levels * levels > static_cast<int>(palette.size()))
+        throw std::runtime_error("colour cube does not fit in the palette");
+    const auto channel = [&](int n) { return n * 255 / (levels - 1); };
+    for (int n = 0; n < levels * levels * levels; ++n)
+        palette[first + n] = Colour{channel(n % levels), channel(n / levels % levels), channel(n / levels / levels)};
+    palette_changed = true;
+}
+
+void IndexedPixelBuffer::FillSpan(int y, const Span& span, const std::uint8_t index)
+{
+    if (y < 0 || y >= size.height)
+        return;
+    const auto x0 = std::max(span.x0, 0);
+    const auto x1 = std::min(span.x1, size.width);
+    if (x0 >= x1)
+        return;
+    std::memset(&buffer[y * size.width + x0], index, x1 - x0);
+    damage.Add(y, x0, x1);
+}
+
+void IndexedPixelBuffer::FilledRectangle(const Rectangle& r, const std::uint8_t index)
+{
+    const auto clipped = ClipTo(r, Rectangle{{}, size});
+    for (int y = clipped.point.y; y < clipped.point.y + clipped.size.height; ++y)
+        FillSpan(y, Span{clipped.point.x, clipped.point.x + clipped.size.width}, index);
+}
+
+void IndexedPixelBuffer::Clear(const std::uint8_t index)
+{
+    for (int y = stale.GetTop(); y < stale.GetBottom(); ++y) {
+        const auto& row = stale.GetRow(y);
+        if (!row.Empty())
+            std::memset(&buffer[y * size.width + row.x0], index, row.x1 - row.x0);
+    }
+}
+
+void IndexedPixelBuffer::Restore(const IndexedPixelBuffer& background)
+{
+    for (int y = stale.GetTop(); y < stale.GetBottom(); ++y) {
+        const auto& row = stale.GetRow(y);
+        if (!row.Empty()) {
+            const auto offset = y * size.width + row.x0;
+            std::memcpy(&buffer[offset], &background.buffer[offset], row.x1 - row.x0);
+        }
+    }
+}
+
+void IndexedPixelBuffer::EndFrame()
+{
+    std::swap(stale, damage);
+    damage.Reset();
+}
+
+void IndexedPixelBuffer::DrawMask(const Point& point, const Size& mask_size, const std::uint8_t* mask, int stride, const std::uint8_t first, int levels)
+{
+    const Rectangle target{point, mask_size};
+    const auto clipped = ClipTo(target, Rectangle{{}, size});
+    if (clipped.size.width <= 0 || clipped.size.height <= 0)
+        return;
+
+    const auto offset = clipped.point - target.point;
+    for (int y = 0; y < clipped.size.height; ++y) {
+        MaskRow(&buffer[(clipped.point.y + y) * size.width + clipped.point.x],
+            &mask[(offset.y + y) * stride + offset.x], first, levels, clipped.size.width);
+    }
+    damage.Add(clipped);
+}
+
+void IndexedPixelBuffer::Blit(const Point& point, const Size& image_size, const std::uint8_t* image, int stride, const std::uint8_t key)
+{
+    const Rectangle target{point, image_size};
+    const auto clipped = ClipTo(target, Rectangle{{}, size});
+    if (clipped.size.width <= 0 || clipped.size.height <= 0)
+        return;
+
+    const auto offset = clipped.point - target.point;
+    for (int y = 0; y < clipped.size.height; ++y) {
+        KeyRow(&buffer[(clipped.point.y + y) * size.width + clipped.point.x],
+            &image[(offset.y + y) * stride + offset.x], key, clipped.size.width);
+    }
+    damage.Add(clipped);
+}
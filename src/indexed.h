@@ -0,0 +1,102 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "pixelbuffer.h"
+#include "types.h"
+
+using Palette = std::array<PixelValue, 256>;
+
+namespace indexed {
+
+// dest[n] = palette[source[n]]; the wider indices look up larger tables,
+// such as the textures of effects
+void Expand(PixelValue* dest, const std::uint8_t* source, const PixelValue* palette, int count);
+void Expand(PixelValue* dest, const std::uint16_t* source, const PixelValue* palette, int count);
+void Expand(PixelValue* dest, const std::uint32_t* source, const PixelValue* palette, int count);
+void Expand(std::uint16_t* dest, const std::uint8_t* source, const std::uint16_t* palette, int count);
+
+// As IndexedPixelBuffer::DrawMask(), unclipped, for a column of pixels
+// that are stride pixels apart
+void MaskColumn(std::uint8_t* dest, std::ptrdiff_t stride, const std::uint8_t* mask, std::uint8_t first, int levels, int count);
+
+// Maps every pixel of image to the nearest colour of a cube set up by
+// IndexedPixelBuffer::SetColourCube(), except for pixels equal to key,
+// which become key_index
+std::vector<std::uint8_t> Quantize(const PixelBuffer& image, std::uint8_t first, int levels, PixelValue key, std::uint8_t key_index);
+
+}
+
+// A pixel buffer of palette indices, a quarter of the size of a PixelBuffer;
+// the palette is only looked up when presenting, so changing it recolours
+// everything drawn with the entries changed without drawing anything
+struct IndexedPixelBuffer {
+    const Size size;
+    std::unique_ptr<std::uint8_t[]> storage;
+    std::uint8_t* buffer;
+    // As with PixelBuffer
+    DamageMap damage;
+    DamageMap stale;
+    Palette palette{};
+    // Set whenever the palette is modified; every pixel must then be looked up
+    // again
+    bool palette_changed{true};
+
+    explicit IndexedPixelBuffer(Size size);
+    const Size& GetSize() const { return size; }
+
+    void SetColour(int index, const Colour& colour)
+    {
+        palette[index] = colour;
+        palette_changed = true;
+    }
+    // Sets the count entries from first to a gradient, from up to and
+    // including to
+    void SetGradient(int first, int count, const Colour& from, const Colour& to);
+    // Moves the count entries from first steps places up, wrapping around
+    void CyclePalette(int first, int count, int steps = 1);
+    // Sets the levels * levels * levels entries from first to evenly spaced
+    // colours, red varying fastest
+    void SetColourCube(int first, int levels);
+
+    std::uint8_t GetPixel(const Point& point) const
+    {
+        if (!In(size, point))
+            return 0;
+        return buffer[point.y * size.width + point.x];
+    }
+
+    void PutPixel(const Point& point, const std::uint8_t index)
+    {
+        if (In(size, point)) {
+            buffer[point.y * size.width + point.x] = index;
+            damage.Add(point.y, point.x, point.x + 1);
+        }
+    }
+
+    void FillSpan(int y, const Span& span, const std::uint8_t index);
+    void FilledRectangle(const Rectangle& r, const std::uint8_t index);
+
+    // As with PixelBuffer
+    void Clear(const std::uint8_t index);
+    void Restore(const IndexedPixelBuffer& background);
+    void EndFrame();
+
+    // Anti-aliasing without blending: each pixel the mask covers becomes one
+    // of the levels entries from first, by coverage; levels is at most 256.
+    // Set these up as a gradient from the background colour to the colour
+    // drawn in
+    void DrawMask(const Point& point, const Size& mask_size, const std::uint8_t* mask, int stride, const std::uint8_t first, int levels);
+    // Copies pixels of an image with the given size and stride, except for
+    // those equal to key
+    void Blit(const Point& point, const Size& image_size, const std::uint8_t* image, int stride, const std::uint8_t key);
+};
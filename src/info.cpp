@@ -7,6 +7,7 @@
 #include "info.h"
 #include <id3/tag.h>
 #include <algorithm>
+#include "util.h"
 
 namespace info {
 
@@ -17,24 +18,34 @@ uint16_t swap_bytes_u16(uint16_t v)
     return (v >> 8) | ((v & 0xff) << 8);
 }
 
+bool is_printable(char32_t ch)
+{
+    // Leaves out the C0 and C1 control characters and surrogates
+    return ch >= 0x20 && !(ch >= 0x7f && ch < 0xa0) && !(ch >= 0xd800 && ch <= 0xdfff);
+}
+
 std::string unicode_to_string(unicode_t* buffer, size_t len)
 {
     std::string s;
     for(size_t n = 0; n < len; ++n) {
         const auto ch = swap_bytes_u16(buffer[n]);
-        if (ch > 0 && ch < 255 && std::isprint(static_cast<unsigned char>(ch))) {
-            s += ch;
+        if (is_printable(ch)) {
+            util::AppendUTF8(s, ch);
         }
     }
     return s;
 }
 
+// ID3 text without an encoding is Latin-1, which maps to Unicode directly
 std::string char_to_string(const char* buffer, size_t len)
 {
-    std::string s(buffer, len);
-    s.erase(std::remove_if(s.begin(), s.end(), [](unsigned char ch) {
-        return !std::isprint(ch);
-    }), s.end());
+    std::string s;
+    for(size_t n = 0; n < len; ++n) {
+        const auto ch = static_cast<unsigned char>(buffer[n]);
+        if (is_printable(ch)) {
+            util::AppendUTF8(s, ch);
+        }
+    }
     return s;
 }
 
@@ -5,177 +5,303 @@
  * For conditions of distribution and use, see LICENSE file
  */
 #include <vector>
+#include <algorithm>
+#include <array>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <pthread.h>
 #include <random>
+#include <optional>
+#include <charconv>
 #include <signal.h>
 #include <utility>
+#include "bands.h"
+#include "compositor.h"
+#include "effects.h"
 #include "font.h"
 #include "pixelbuffer.h"
 #include "framebuffer.h"
 #include "image.h"
+#include "indexed.h"
 #include "info.h"
 #include "types.h"
 #include "util.h"
 #include "player.h"
 #include "http.h"
+#include "scheduler.h"
+#include "sprite.h"
+#include "spdlog/spdlog.h"
 
 namespace {
 
-static constexpr inline auto SHOW_COPPERBARS = true;
-static constexpr inline auto SHOW_LOGO = true;
-static constexpr inline auto SHOW_STARFIELD = true;
-static constexpr inline auto SHOW_CURRENT = true;
-static constexpr inline auto SHOW_PREVIOUS = true;
-
-enum class ScrollDirection {
-    RightToLeft,
-    LeftToRight,
+// All layers; the full screen effects hide anything below them
+static constexpr inline std::array<std::string_view, 8> LAYERS{ "plasma", "rotozoom", "tunnel", "stars", "bars", "logo", "current", "previous" };
+// Layers that can be drawn with --indexed
+static constexpr inline std::array<std::string_view, 5> INDEXED_LAYERS{ "stars", "bars", "logo", "current", "previous" };
+// Shown unless --layers is given, bottom first; the logo is static, so at the
+// bottom it is drawn into the background once rather than every frame
+static constexpr inline std::array<std::string_view, 5> DEFAULT_LAYERS{ "logo", "stars", "bars", "current", "previous" };
+
+struct Options {
+    FrameBufferOptions framebuffer;
+    // Stop after this many frames; 0 keeps running until terminated
+    int frames{};
+    // Target frame rate; 0 renders as fast as possible
+    int fps{60};
+    // Wait for the vertical blank rather than sleeping, if supported
+    bool vsync{};
+    // Log frame time statistics this often; 0 disables
+    int stats_interval{};
+    // Pin the render thread to this CPU; -1 leaves it to the scheduler
+    int render_cpu{-1};
+    // Split frames in this many bands, rendered in parallel
+    int bands{1};
+    int stars{effects::Starfield::DefaultCount};
+    // Amplitude of the wave the current track moves along; 0 keeps it straight
+    int wave{};
+    // Play music and serve the web frontend
+    bool player{true};
+    // Draw with palette indices into an IndexedPixelBuffer
+    bool indexed{};
+    // Layers to show, bottom first
+    std::vector<std::string_view> layers{ DEFAULT_LAYERS.begin(), DEFAULT_LAYERS.end() };
 };
 
-struct Scroller
+std::optional<int> ParseInt(std::string_view sv)
 {
-    font::Font& font;
-    int speed{1};
-    ScrollDirection direction;
-    int x{0};
-    std::string text;
-    int width{0};
-
-    void SetText(std::string sv)
-    {
-        text = std::move(sv);
-        width = font::GetTextWidth(font, text);
-        if (direction == ScrollDirection::RightToLeft) {
-            x = width;
-        } else /* direction == ScrollDirection::LeftToRight */ {
-            x = -width;
-        }
-    }
+    int value;
+    const auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+    if (ec != std::errc{} || ptr != sv.data() + sv.size())
+        return {};
+    return value;
+}
 
-    void Update(PixelBuffer& pb, const Colour& colour, int y)
-    {
-        font::DrawText(pb, font, { x, y }, colour, text);
-        if (direction == ScrollDirection::RightToLeft) {
-            x -= speed;
-            if (x < -width)
-                x = pb.GetSize().width;
-        } else /* direction == ScrollDirection::LeftToRight */ {
-            x += speed;
-            if (x > pb.GetSize().width)
-                x = -width;
-        }
-    }
-};
+std::optional<Size> ParseSize(std::string_view sv)
+{
+    const auto x = sv.find('x');
+    if (x == std::string_view::npos)
+        return {};
+    const auto width = ParseInt(sv.substr(0, x));
+    const auto height = ParseInt(sv.substr(x + 1));
+    if (!width || !height)
+        return {};
+    return Size{*width, *height};
+}
 
-class Copperbar
+void Usage(const char* argv0)
 {
-    const int half_height;
-    const int top;
-    const int bottom;
-    const Colour from_colour;
-    const Colour to_colour;
-    int y;
-    int direction{1};
-public:
-    Copperbar(const int height, const int top, const int bottom, const Colour& from_colour, const Colour& to_colour)
-        : half_height(height / 2), top(top), bottom(bottom), from_colour(from_colour), to_colour(to_colour)
-    {
-        y = top;
-        direction = 1;
-    }
+    std::cerr << "usage: " << argv0 << " [options]\n"
+              << "  --backend=fb|memory|dump|shm  where to render to (default: fb)\n"
+              << "  --output=PATH                 framebuffer device, dump file (.ppm or raw) or\n"
+              << "                                shared memory name\n"
+              << "  --size=WxH                    size of non-fb backends (default: 320x240)\n"
+              << "  --bpp=16|32                   depth of non-fb backends (default: 32)\n"
+              << "  --render-size=WxH             render at this size and scale up to the framebuffer\n"
+              << "  --scale=nearest|bilinear      filter to scale up with (default: nearest)\n"
+              << "  --no-page-flip                always copy to the framebuffer\n"
+              << "  --in-place                    draw straight into the off-screen page; slow if\n"
+              << "                                the framebuffer is uncached\n"
+              << "  --dither                      dither when presenting at 16bpp\n"
+              << "  --rotate=0|90|180|270         rotate clockwise when presenting (default: 0)\n"
+              << "  --mirror                      mirror left to right when presenting\n"
+              << "  --frames=N                    exit after N frames and report the frame rate\n"
+              << "  --fps=N                       target frame rate (default: 60)\n"
+              << "  --uncapped                    do not limit the frame rate\n"
+              << "  --vsync                       pace frames on the vertical blank if supported\n"
+              << "  --stats=SECONDS               log frame time statistics periodically\n"
+              << "  --render-cpu=N                pin the render thread to CPU N\n"
+              << "  --bands=N                     render N horizontal bands in parallel\n"
+              << "  --stars=N                     number of stars (default: 100)\n"
+              << "  --wave=PIXELS                 move the current track up and down along a sine\n"
+              << "                                wave\n"
+              << "  --no-player                   only render, do not play music or serve HTTP\n"
+              << "  --indexed                     draw with a 256 colour palette; not with --bands\n"
+              << "                                or the full screen effects\n"
+              << "  --layers=NAME,...             layers to show, bottom first (default: logo,stars,\n"
+              << "                                bars,current,previous); also plasma, rotozoom and\n"
+              << "                                tunnel\n";
+}
 
-    void Advance(int steps = 1)
-    {
-        while (steps--) {
-            y += direction;
-            if (direction > 0) {
-                if (y > bottom - half_height) {
-                    direction = -direction;
-                }
-            } else /* direction < 0 */ {
-                if (y < top - half_height) {
-                    direction = -direction;
-                }
+std::optional<Options> ParseOptions(int argc, char* argv[])
+{
+    Options options;
+    std::optional<std::string> output;
+    for (int n = 1; n < argc; ++n) {
+        const std::string_view arg(argv[n]);
+        const auto equals = arg.find('=');
+        const auto key = arg.substr(0, equals);
+        const auto value = equals != std::string_view::npos ? arg.substr(equals + 1) : std::string_view{};
+
+        if (key == "--backend") {
+            if (value == "fb") {
+                options.framebuffer.backend = Backend::Device;
+            } else if (value == "memory") {
+                options.framebuffer.backend = Backend::Memory;
+            } else if (value == "dump") {
+                options.framebuffer.backend = Backend::Dump;
+            } else if (value == "shm") {
+                options.framebuffer.backend = Backend::SharedMemory;
+            } else {
+                return {};
+            }
+        } else if (key == "--output") {
+            output = value;
+        } else if (key == "--size") {
+            const auto size = ParseSize(value);
+            if (!size)
+                return {};
+            options.framebuffer.size = *size;
+        } else if (key == "--render-size") {
+            const auto size = ParseSize(value);
+            if (!size)
+                return {};
+            options.framebuffer.render_size = *size;
+        } else if (key == "--rotate") {
+            if (value == "0") {
+                options.framebuffer.rotation = rotate::Rotation::None;
+            } else if (value == "90") {
+                options.framebuffer.rotation = rotate::Rotation::Degrees90;
+            } else if (value == "180") {
+                options.framebuffer.rotation = rotate::Rotation::Degrees180;
+            } else if (value == "270") {
+                options.framebuffer.rotation = rotate::Rotation::Degrees270;
+            } else {
+                return {};
+            }
+        } else if (key == "--scale") {
+            if (value == "nearest") {
+                options.framebuffer.filter = scale::Filter::Nearest;
+            } else if (value == "bilinear") {
+                options.framebuffer.filter = scale::Filter::Bilinear;
+            } else {
+                return {};
             }
+        } else if (key == "--bpp") {
+            const auto bpp = ParseInt(value);
+            if (!bpp)
+                return {};
+            options.framebuffer.bits_per_pixel = *bpp;
+        } else if (key == "--frames") {
+            const auto frames = ParseInt(value);
+            if (!frames || *frames < 0)
+                return {};
+            options.frames = *frames;
+        } else if (key == "--fps") {
+            const auto fps = ParseInt(value);
+            if (!fps || *fps < 0)
+                return {};
+            options.fps = *fps;
+        } else if (key == "--stats") {
+            const auto interval = ParseInt(value);
+            if (!interval || *interval < 0)
+                return {};
+            options.stats_interval = *interval;
+        } else if (key == "--render-cpu") {
+            const auto cpu = ParseInt(value);
+            if (!cpu || *cpu < 0)
+                return {};
+            options.render_cpu = *cpu;
+        } else if (key == "--bands") {
+            const auto bands = ParseInt(value);
+            if (!bands || *bands < 1)
+                return {};
+            options.bands = *bands;
+        } else if (key == "--stars") {
+            const auto stars = ParseInt(value);
+            if (!stars || *stars < 0)
+                return {};
+            options.stars = *stars;
+        } else if (key == "--wave") {
+            const auto wave = ParseInt(value);
+            if (!wave || *wave < 0)
+                return {};
+            options.wave = *wave;
+        } else if (key == "--layers") {
+            options.layers.clear();
+            for (auto rest = value; !rest.empty();) {
+                const auto comma = std::min(rest.find(','), rest.size());
+                const auto name = rest.substr(0, comma);
+                if (std::find(LAYERS.begin(), LAYERS.end(), name) == LAYERS.end())
+                    return {};
+                options.layers.push_back(name);
+                rest.remove_prefix(std::min(comma + 1, rest.size()));
+            }
+        } else if (arg == "--vsync") {
+            options.vsync = true;
+        } else if (arg == "--no-page-flip") {
+            options.framebuffer.page_flip = false;
+        } else if (arg == "--in-place") {
+            options.framebuffer.render_in_place = true;
+        } else if (arg == "--mirror") {
+            options.framebuffer.mirror = true;
+        } else if (arg == "--dither") {
+            options.framebuffer.dither = true;
+        } else if (arg == "--uncapped") {
+            options.fps = 0;
+        } else if (arg == "--no-player") {
+            options.player = false;
+        } else if (arg == "--indexed") {
+            options.indexed = true;
+        } else {
+            return {};
         }
     }
 
-    void Update(PixelBuffer& pb)
-    {
-        Advance();
-        for (int j = 0; j < half_height; ++j) {
-            const auto c = Blend(from_colour, to_colour, static_cast<float>(j) / static_cast<float>(half_height));
-            pb.Line({ 0, y - half_height + j }, { pb.GetSize().width, y - half_height + j }, c);
-        }
-        for (int j = 0; j < half_height; ++j) {
-            const auto c = Blend(to_colour, from_colour, static_cast<float>(j) / static_cast<float>(half_height));
-            pb.Line({ 0, y + j }, { pb.GetSize().width, y + j }, c);
+    if (options.indexed) {
+        if (options.bands > 1)
+            return {};
+        for (const auto name : options.layers) {
+            if (std::find(INDEXED_LAYERS.begin(), INDEXED_LAYERS.end(), name) == INDEXED_LAYERS.end())
+                return {};
         }
     }
-};
 
-void PlotLogo(PixelBuffer& pb, PixelBuffer& logo, int dest_x, int dest_y)
-{
-        for(int y = 0; y < logo.GetSize().height; ++y) {
-            for (int x = 0; x < logo.GetSize().width; ++x) {
-                auto p = &pb.buffer[(dest_y + y) * pb.GetSize().width + dest_x + x];
-                auto source = &logo.buffer[y * logo.GetSize().width + x];
-                if (*source != 0xffffffff)
-                    *p = *source;
-            }
-        }
+    if (output) {
+        options.framebuffer.path = *output;
+    } else if (options.framebuffer.backend == Backend::Dump) {
+        options.framebuffer.path = "frames.ppm";
+    } else if (options.framebuffer.backend == Backend::SharedMemory) {
+        options.framebuffer.path = "/partyplayer";
+    }
+    return options;
 }
 
-struct Star {
-    Point position;
-    int intensity{};
+struct TrackText {
+    std::string current;
+    std::string previous;
 };
 
-struct Starfield {
-    const Rectangle rect;
-    std::array<Star, 100> stars;
-
-    std::uniform_int_distribution<int> x_dist;
-    std::uniform_int_distribution<int> y_dist;
-    std::uniform_int_distribution<int> intensity_dist;
-
-    void ResetStar(std::mt19937& rng, Star& s)
-    {
-        s.position.x = rect.point.x + rect.size.width + x_dist(rng);
-        s.position.y = rect.point.y + y_dist(rng);
-        s.intensity = intensity_dist(rng);
-    }
+// Hands the track text from the player to the render thread without the
+// latter ever having to wait for the former
+class TrackTextSnapshot {
+    std::atomic<std::shared_ptr<const TrackText>> text;
+    std::atomic<uint64_t> generation{};
 
-    Starfield(std::mt19937& rng, const Rectangle& r)
-        : rect(r)
-        , x_dist(0, 20)
-        , y_dist(0, r.size.height)
-        , intensity_dist(1, 10)
+public:
+    void Publish(TrackText t)
     {
-        for(auto& star: stars) {
-            ResetStar(rng, star);
-        }
+        text.store(std::make_shared<const TrackText>(std::move(t)));
+        generation.fetch_add(1, std::memory_order_release);
     }
 
-    void Update(std::mt19937& rng, PixelBuffer& pb)
+    // Returns the text if it was published after the generation in seen
+    std::shared_ptr<const TrackText> GetIfChanged(uint64_t& seen) const
     {
-        const Colour from{0, 0, 0};
-        const Colour to{255, 255, 255};
-        for(auto& star: stars) {
-            pb.PutPixel(star.position, Blend(from, to, static_cast<float>(star.intensity - 1) / 9.0f));
-
-            star.position.x -= star.intensity;
-            if (star.position.x < 0)
-                ResetStar(rng, star);
-        }
+        const auto current = generation.load(std::memory_order_acquire);
+        if (current == seen)
+            return {};
+        seen = current;
+        return text.load();
     }
 };
 
-bool terminating = false;
+std::atomic<bool> terminating = false;
 bool child_attention = false;
 
 void hook_signal(int signum, void(*handler)(int))
@@ -185,90 +311,250 @@ void hook_signal(int signum, void(*handler)(int))
     sigaction(signum, &sa, nullptr);
 }
 
-}
-
-int main()
+void RenderLoop(const Options& options, FrameBuffer& fb, const TrackTextSnapshot& track_text)
 {
-    hook_signal(SIGINT, [](int) { terminating = true; });
-    hook_signal(SIGTERM, [](int) { terminating = true; });
-    hook_signal(SIGCHLD, [](int) { child_attention = true; });
-
     std::random_device rd;
     std::mt19937 rng;
     rng.seed(rd());
 
-    util::TextFile tf(util::ReadFile("../data/files.txt"));
-    player::TrackPicker items(rng, std::move(tf), 0);
+    auto& pb = fb.GetPixelBuffer();
 
-    player::Player player(std::move(items));
+    // Scroller text is rendered once per track, so finer positioning is free
+    // as far as frames are concerned. The glyphs are baked by the build, see
+    // src/CMakeLists.txt
+    font::Font main_font(util::ReadFile("../data/Roboto-Regular.ttf"), 70, font::Positioning::QuarterPixel, "fonts/Roboto-Regular-70.glyphs");
+    font::Font thin_font(util::ReadFile("../data/Roboto-Thin.ttf"), 20, font::Positioning::QuarterPixel, "fonts/Roboto-Thin-20.glyphs");
 
-    http::Server server(player, 8000);
+    // White is the transparent colour of the logo
+    const sprite::Sprite logo(image::Decode(util::ReadFile("../data/logo.png")), 0xffffffff);
 
-    FrameBuffer fb("/dev/fb0");
-    std::cout << "framebuffer size " << fb.GetSize().width << " x " << fb.GetSize().height << '\n';
-    PixelBuffer pb(fb.GetSize());
-
-    font::Font main_font(util::ReadFile("../data/Roboto-Regular.ttf"), 70);
-    font::Font thin_font(util::ReadFile("../data/Roboto-Thin.ttf"), 20);
-
-    auto logo = image::Decode(util::ReadFile("../data/logo.png"));
-
-    Scroller main_scroller(main_font);
-    main_scroller.direction = ScrollDirection::RightToLeft;
+    effects::Scroller main_scroller(main_font);
+    main_scroller.direction = effects::ScrollDirection::RightToLeft;
     main_scroller.speed = 2;
+    main_scroller.wave_amplitude = options.wave;
     main_scroller.SetText("Starting up...");
 
-    Scroller thin_scroller(thin_font);
-    thin_scroller.direction = ScrollDirection::LeftToRight;
+    effects::Scroller thin_scroller(thin_font);
+    thin_scroller.direction = effects::ScrollDirection::LeftToRight;
     thin_scroller.SetText("Hold your horses!");
 
-    Copperbar redbar(20, 40, 120, {0, 0, 0}, {255, 0, 0});
-    Copperbar greenbar(20, 40, 120, {0, 0, 0}, {0, 255, 0});
-    Copperbar bluebar(20, 40, 120, {0, 0, 0}, {0, 0, 255});
-    greenbar.Advance(20);
-    bluebar.Advance(40);
+    effects::Copper copper(pb.GetSize().height);
+    copper.Add({ 20, {0, 0, 0}, {255, 0, 0}, 70, 40, 160, 0 });
+    copper.Add({ 20, {0, 0, 0}, {0, 255, 0}, 70, 40, 160, 20 });
+    copper.Add({ 20, {0, 0, 0}, {0, 0, 255}, 70, 40, 160, 40 });
 
     const auto logo_x = (pb.GetSize().width - logo.GetSize().width) / 2;
     const auto logo_y = 40 + (logo.GetSize().height / 2);
 
-    Starfield starfield(rng, { 0, 0, pb.GetSize().width, pb.GetSize().height });
-
-    child_attention = true;
-    while(!terminating) {
-        if (std::exchange(child_attention, false)) {
-            player.OnChildTermination();
-
-            main_scroller.SetText(std::string(player.GetCurrentTrackInfo()));
-            if (!player.GetPreviousTrackInfo().empty()) {
-                thin_scroller.SetText(std::string("Previous track: ") + std::string(player.GetPreviousTrackInfo()));
+    effects::Starfield starfield({ 0, 0, pb.GetSize().width, pb.GetSize().height }, rng(), options.stars);
+
+    const Rectangle screen{ {}, pb.GetSize() };
+    effects::Plasma plasma(screen);
+    effects::Rotozoom rotozoom(screen);
+    effects::Tunnel tunnel(screen);
+
+    compositor::Compositor layers(pb, Colour{ 0, 0, 0 });
+    layers.Add({ "plasma", false, false,
+        [&](PixelBuffer& pb) { plasma.Draw(pb); },
+        [&] { plasma.Advance(); } });
+    layers.Add({ "rotozoom", false, false,
+        [&](PixelBuffer& pb) { rotozoom.Draw(pb); },
+        [&] { rotozoom.Advance(); } });
+    layers.Add({ "tunnel", false, false,
+        [&](PixelBuffer& pb) { tunnel.Draw(pb); },
+        [&] { tunnel.Advance(); } });
+    layers.Add({ "stars", false, true,
+        [&](PixelBuffer& pb) { starfield.Draw(pb); },
+        [&] { starfield.Advance(); } });
+    layers.Add({ "bars", false, true,
+        [&](PixelBuffer& pb) { copper.Draw(pb); },
+        [&] { copper.Advance(); } });
+    layers.Add({ "logo", true, true, [&](PixelBuffer& pb) { logo.Draw(pb, { logo_x, logo_y }); } });
+    layers.Add({ "current", false, true,
+        [&](PixelBuffer& pb) { main_scroller.Draw(pb, { 255, 255, 255 }, 130); },
+        [&] { main_scroller.Advance(pb.GetSize().width); } });
+    layers.Add({ "previous", false, true,
+        [&](PixelBuffer& pb) { thin_scroller.Draw(pb, { 255, 255, 255 }, pb.GetSize().height - 20); },
+        [&] { thin_scroller.Advance(pb.GetSize().width); } });
+    layers.SetOrder(options.layers);
+
+    // With --indexed, the same layers are drawn with palette indices: black,
+    // then the stars, the copper bars, the shades of the text and a colour
+    // cube for the logo. Text is anti-aliased against black rather than
+    // blended, and every layer is drawn each frame
+    std::optional<IndexedPixelBuffer> ib;
+    std::vector<std::function<void(IndexedPixelBuffer&)>> indexed_layers;
+    std::vector<std::uint8_t> indexed_logo;
+    if (options.indexed) {
+        constexpr int text_levels = 8;
+        constexpr int cube_levels = 5;
+        const int star_colours = 1;
+        const int copper_colours = star_colours + starfield.GetLayerCount();
+        const int text_colours = copper_colours + copper.GetColourCount();
+        const int logo_colours = text_colours + text_levels;
+
+        ib.emplace(pb.GetSize());
+        ib->SetColour(0, Colour{ 0, 0, 0 });
+        starfield.SetPalette(*ib, star_colours);
+        copper.SetPalette(*ib, copper_colours);
+        ib->SetGradient(text_colours, text_levels, Colour{ 0, 0, 0 }, Colour{ 255, 255, 255 });
+        ib->SetColourCube(logo_colours, cube_levels);
+        indexed_logo = indexed::Quantize(image::Decode(util::ReadFile("../data/logo.png")), logo_colours, cube_levels, 0xffffffff, 0);
+
+        for (const auto name : options.layers) {
+            if (name == "stars") {
+                indexed_layers.push_back([&, star_colours](IndexedPixelBuffer& ib) {
+                    starfield.Draw(ib, star_colours);
+                    starfield.Advance();
+                });
+            } else if (name == "bars") {
+                indexed_layers.push_back([&, copper_colours](IndexedPixelBuffer& ib) {
+                    copper.Draw(ib, copper_colours);
+                    copper.Advance();
+                });
+            } else if (name == "logo") {
+                indexed_layers.push_back([&](IndexedPixelBuffer& ib) {
+                    ib.Blit({ logo_x, logo_y }, logo.GetSize(), indexed_logo.data(), logo.GetSize().width, 0);
+                });
+            } else if (name == "current") {
+                indexed_layers.push_back([&, text_colours](IndexedPixelBuffer& ib) {
+                    main_scroller.Draw(ib, text_colours, text_levels, 130);
+                    main_scroller.Advance(ib.GetSize().width);
+                });
+            } else if (name == "previous") {
+                indexed_layers.push_back([&, text_colours](IndexedPixelBuffer& ib) {
+                    thin_scroller.Draw(ib, text_colours, text_levels, ib.GetSize().height - 20);
+                    thin_scroller.Advance(ib.GetSize().width);
+                });
             }
         }
+    }
+
+    std::optional<bands::BandedRenderer> banded;
+    if (const auto band_count = std::min(options.bands, pb.GetSize().height); band_count > 1) {
+        banded.emplace(pb, band_count, std::min<int>(band_count, std::thread::hardware_concurrency()));
+        spdlog::info("rendering {} bands on {} threads", band_count, banded->GetThreadCount());
+    }
+    const std::function<void(PixelBuffer&)> draw_layers = [&](PixelBuffer& band) { layers.Draw(band); };
 
-        pb.FilledRectangle({ {}, fb.GetSize() }, Colour{ 0, 0, 0 } );
-        if constexpr (SHOW_STARFIELD) {
-            starfield.Update(rng, pb);
+    FrameScheduler scheduler(options.fps);
+    if (options.vsync)
+        scheduler.SetVSync([&] { return fb.WaitForVSync(); });
+
+    uint64_t track_text_generation = 0;
+    int frame = 0;
+    const auto start = std::chrono::steady_clock::now();
+    auto next_stats = start + std::chrono::seconds{ options.stats_interval };
+    while(!terminating) {
+        if (const auto text = track_text.GetIfChanged(track_text_generation); text) {
+            main_scroller.SetText(text->current);
+            if (!text->previous.empty()) {
+                thin_scroller.SetText(std::string("Previous track: ") + text->previous);
+            }
         }
 
-        if constexpr (SHOW_COPPERBARS) {
-            redbar.Update(pb);
-            greenbar.Update(pb);
-            bluebar.Update(pb);
+        if (ib) {
+            ib->Clear(0);
+            for (const auto& draw : indexed_layers)
+                draw(*ib);
+            fb.Render(*ib);
+        } else {
+            if (banded) {
+                layers.Advance();
+                banded->Render(draw_layers);
+            } else {
+                layers.Render();
+            }
+            fb.Render(pb);
         }
-        if constexpr (SHOW_LOGO) {
-            PlotLogo(pb, logo, logo_x, logo_y);
+        if (++frame == options.frames)
+            break;
+
+        scheduler.Wait({});
+
+        if (options.stats_interval > 0 && std::chrono::steady_clock::now() >= next_stats) {
+            const auto stats = scheduler.GetStatistics();
+            spdlog::info("frame time min {}us avg {}us p99 {}us, {} frames, {} dropped",
+                stats.min.count(), stats.average.count(), stats.p99.count(), stats.frames, stats.dropped);
+            for (const auto font : { &main_font, &thin_font }) {
+                const auto& cache = font->GetCacheStatistics();
+                spdlog::info("glyph cache {} hits, {} misses, {} evictions", cache.hits, cache.misses, cache.evictions);
+            }
+            next_stats += std::chrono::seconds{ options.stats_interval };
         }
+    }
 
-        if constexpr (SHOW_CURRENT) {
-            main_scroller.Update(pb, { 255, 255, 255 }, 130);
-        }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << frame << " frames in " << elapsed << "s, " << frame / elapsed << " fps\n";
+    terminating = true;
+}
+
+}
 
-        if constexpr (SHOW_PREVIOUS) {
-            thin_scroller.Update(pb, { 255, 255, 255 }, pb.GetSize().height - 20);
+int main(int argc, char* argv[])
+{
+    const auto options = ParseOptions(argc, argv);
+    if (!options) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    hook_signal(SIGINT, [](int) { terminating = true; });
+    hook_signal(SIGTERM, [](int) { terminating = true; });
+    hook_signal(SIGCHLD, [](int) { child_attention = true; });
+
+    std::random_device rd;
+    std::mt19937 rng;
+    rng.seed(rd());
+
+    std::optional<player::Player> player;
+    std::optional<http::Server> server;
+    if (options->player) {
+        util::TextFile tf(util::ReadFile("../data/files.txt"));
+        player::TrackPicker items(rng, std::move(tf), 0);
+
+        player.emplace(std::move(items));
+        server.emplace(*player, 8000);
+    }
+
+    FrameBuffer fb(options->framebuffer);
+    std::cout << "framebuffer size " << fb.GetSize().width << " x " << fb.GetSize().height << '\n';
+    if (fb.GetRenderSize() != fb.GetSize())
+        std::cout << "render size " << fb.GetRenderSize().width << " x " << fb.GetRenderSize().height << '\n';
+
+    TrackTextSnapshot track_text;
+    // Signals are for the main thread to handle; the render thread inherits
+    // the mask, so it must already be blocked when the thread starts
+    sigset_t all_signals, previous_signals;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &previous_signals);
+    std::thread render_thread(RenderLoop, std::cref(*options), std::ref(fb), std::cref(track_text));
+    pthread_sigmask(SIG_SETMASK, &previous_signals, nullptr);
+    if (options->render_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(options->render_cpu, &cpus);
+        if (pthread_setaffinity_np(render_thread.native_handle(), sizeof(cpus), &cpus) != 0)
+            spdlog::warn("unable to pin render thread to cpu {}", options->render_cpu);
+    }
+
+    child_attention = true;
+    while(!terminating) {
+        if (player && std::exchange(child_attention, false)) {
+            player->OnChildTermination();
+            track_text.Publish(TrackText{
+                std::string(player->GetCurrentTrackInfo()),
+                std::string(player->GetPreviousTrackInfo())
+            });
         }
 
-        fb.Render(pb);
-        server.Handle(std::chrono::milliseconds{ 10 });
+        if (server) {
+            server->Handle(std::chrono::milliseconds{ 100 });
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds{ 100 });
+        }
     }
 
+    render_thread.join();
     return 0;
 }
@@ -5,27 +5,175 @@
  * For conditions of distribution and use, see LICENSE file
  */
 #include "pixelbuffer.h"
+#include <cstring>
+#include "blend.h"
 
-PixelBuffer::PixelBuffer(Size size) : size(std::move(size))
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+void Fill(PixelValue* dest, const PixelValue v, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto vv = vdupq_n_u32(v);
+    for (; n + 8 <= count; n += 8) {
+        vst1q_u32(dest + n, vv);
+        vst1q_u32(dest + n + 4, vv);
+    }
+#elif defined(__SSE2__)
+    const auto vv = _mm_set1_epi32(static_cast<int>(v));
+    for (; n + 8 <= count; n += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), vv);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n + 4), vv);
+    }
+#endif
+    for (; n < count; ++n)
+        dest[n] = v;
+}
+
+// Calls fn(offset, count) for the stale part of every row within the clip
+template<typename Fn>
+void ForEachStaleSpan(const PixelBuffer& pb, Fn fn)
+{
+    const auto& clip = pb.GetClip();
+    const auto& stale = pb.GetStale();
+    const auto top = std::max(stale.GetTop(), clip.point.y);
+    const auto bottom = std::min(stale.GetBottom(), clip.point.y + clip.size.height);
+    for (int y = top; y < bottom; ++y) {
+        const auto& row = stale.GetRow(y);
+        const auto x0 = std::max(row.x0, clip.point.x);
+        const auto x1 = std::min(row.x1, clip.point.x + clip.size.width);
+        if (x0 < x1)
+            fn(y * pb.GetSize().width + x0, x1 - x0);
+    }
+}
+
+}
+
+PixelBuffer::PixelBuffer(Size size)
+    : size(std::move(size)), damage(size.height), stale(size.height), clip{{}, size}
+{
+    storage = std::make_unique<PixelValue[]>(size.height * size.width);
+    buffer = storage.get();
+    stale.Add(::Rectangle{{}, size});
+}
+
+PixelBuffer::PixelBuffer(Size size, PixelValue* memory)
+    : size(std::move(size)), buffer(memory), damage(size.height), stale(size.height), clip{{}, size}
+{
+    stale.Add(::Rectangle{{}, size});
+}
+
+PixelBuffer::PixelBuffer(const PixelBuffer& parent, const ::Rectangle& clip)
+    : size(parent.size), buffer(parent.buffer), damage(size.height), stale(0), parent_stale(&parent.GetStale())
+    , clip(ClipTo(clip, ::Rectangle{{}, size}))
 {
-    buffer = std::make_unique<PixelValue[]>(size.height * size.width);
 }
 
 void PixelBuffer::FilledRectangle(const struct Rectangle& r, const Colour& colour)
 {
-    const auto activeRectangle = ClipTo(r, ::Rectangle{{}, size});
+    const auto activeRectangle = ClipTo(r, clip);
+    damage.Add(activeRectangle);
 
+    const PixelValue v = colour;
     auto ptr = &buffer[activeRectangle.point.y * size.width + activeRectangle.point.x];
     for (auto y = 0; y < activeRectangle.size.height; ++y) {
-        for (auto x = 0; x < activeRectangle.size.width; ++x) {
-            *ptr++ = colour;
-        }
-        ptr += size.width - activeRectangle.size.width;
+        Fill(ptr, v, activeRectangle.size.width);
+        ptr += size.width;
     }
 }
 
+void PixelBuffer::FillSpan(int y, const Span& span, const PixelValue colour)
+{
+    if (y < clip.point.y || y >= clip.point.y + clip.size.height)
+        return;
+    const auto x0 = std::max(span.x0, clip.point.x);
+    const auto x1 = std::min(span.x1, clip.point.x + clip.size.width);
+    if (x0 >= x1)
+        return;
+    Fill(&buffer[y * size.width + x0], colour, x1 - x0);
+    damage.Add(y, x0, x1);
+}
+
+void PixelBuffer::HLine(int x0, int x1, int y, const PixelValue colour)
+{
+    if (x0 > x1)
+        std::swap(x0, x1);
+    FillSpan(y, Span{x0, x1 + 1}, colour);
+}
+
+void PixelBuffer::VLine(int x, int y0, int y1, const PixelValue colour)
+{
+    if (x < clip.point.x || x >= clip.point.x + clip.size.width)
+        return;
+    if (y0 > y1)
+        std::swap(y0, y1);
+    y0 = std::max(y0, clip.point.y);
+    y1 = std::min(y1, clip.point.y + clip.size.height - 1);
+
+    for (int y = y0; y <= y1; ++y) {
+        buffer[y * size.width + x] = colour;
+        damage.Add(y, x, x + 1);
+    }
+}
+
+void PixelBuffer::Clear(const Colour& colour)
+{
+    const PixelValue v = colour;
+    ForEachStaleSpan(*this, [&](int offset, int count) {
+        Fill(&buffer[offset], v, count);
+    });
+}
+
+void PixelBuffer::Restore(const PixelBuffer& background)
+{
+    ForEachStaleSpan(*this, [&](int offset, int count) {
+        std::memcpy(&buffer[offset], &background.buffer[offset], count * sizeof(PixelValue));
+    });
+}
+
+void PixelBuffer::EndFrame()
+{
+    std::swap(stale, damage);
+    damage.Reset();
+}
+
+void PixelBuffer::BlendMask(const Point& point, const Size& mask_size, const uint8_t* mask, int stride, const PixelValue colour)
+{
+    BlendMask(point, mask_size, mask, stride, colour, clip);
+}
+
+void PixelBuffer::BlendMask(const Point& point, const Size& mask_size, const uint8_t* mask, int stride, const PixelValue colour, const ::Rectangle& mask_clip)
+{
+    const ::Rectangle target{point, mask_size};
+    const auto clipped = ClipTo(ClipTo(target, mask_clip), clip);
+    if (clipped.size.width <= 0 || clipped.size.height <= 0)
+        return;
+
+    const auto offset = clipped.point - target.point;
+    for (int y = 0; y < clipped.size.height; ++y) {
+        blend::Mask(&buffer[(clipped.point.y + y) * size.width + clipped.point.x],
+            &mask[(offset.y + y) * stride + offset.x], colour, clipped.size.width);
+    }
+    damage.Add(clipped);
+}
+
 void PixelBuffer::Line(const Point& from, const Point& to, const Colour& colour)
 {
+    if (from.y == to.y) {
+        HLine(from.x, to.x, from.y, colour);
+        return;
+    }
+    if (from.x == to.x) {
+        VLine(from.x, from.y, to.y, colour);
+        return;
+    }
+
     // Bresenham algorithm from https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
     const auto abs = [](int x) { return x >= 0 ? x : -x; };
 
@@ -56,8 +204,8 @@ void PixelBuffer::Rectangle(const struct Rectangle& r, const Colour& colour)
 {
     const auto from = r.point;
     const auto to = r.point + r.size;
-    Line(Point{from.x, from.y}, Point{to.x, from.y}, colour);
-    Line(Point{from.x, from.y}, Point{from.x, to.y}, colour);
-    Line(Point{from.x, to.y}, Point{to.x, to.y}, colour);
-    Line(Point{to.x, from.y}, Point{to.x, to.y}, colour);
+    HLine(from.x, to.x, from.y, colour);
+    VLine(from.x, from.y, to.y, colour);
+    HLine(from.x, to.x, to.y, colour);
+    VLine(to.x, from.y, to.y, colour);
 }
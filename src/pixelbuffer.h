@@ -6,16 +6,94 @@
  */
 #pragma once
 
+#include <climits>
 #include <memory>
+#include <vector>
 #include "types.h"
 
+// Horizontal run of pixels [x0, x1)
+struct Span {
+    int x0{INT_MAX}, x1{INT_MIN};
+
+    bool Empty() const { return x0 >= x1; }
+};
+
+constexpr Span Hull(const Span& a, const Span& b)
+{
+    return Span{std::min(a.x0, b.x0), std::max(a.x1, b.x1)};
+}
+
+// Tracks which part of each row has been touched, as a single span per row
+class DamageMap {
+    std::vector<Span> rows;
+    int top{INT_MAX}, bottom{INT_MIN};
+
+public:
+    explicit DamageMap(int height) : rows(height) { }
+
+    void Add(int y, int x0, int x1)
+    {
+        // Clipping leaves empty spans that may lie outside the buffer
+        if (x0 >= x1)
+            return;
+        auto& span = rows[y];
+        span.x0 = std::min(span.x0, x0);
+        span.x1 = std::max(span.x1, x1);
+        top = std::min(top, y);
+        bottom = std::max(bottom, y + 1);
+    }
+
+    void Add(const Rectangle& r)
+    {
+        for (int y = r.point.y; y < r.point.y + r.size.height; ++y)
+            Add(y, r.point.x, r.point.x + r.size.width);
+    }
+
+    void Add(const DamageMap& other)
+    {
+        for (int y = other.top; y < other.bottom; ++y) {
+            if (!other.rows[y].Empty())
+                Add(y, other.rows[y].x0, other.rows[y].x1);
+        }
+    }
+
+    void Reset()
+    {
+        for (int y = top; y < bottom; ++y)
+            rows[y] = {};
+        top = INT_MAX;
+        bottom = INT_MIN;
+    }
+
+    bool Empty() const { return top >= bottom; }
+    int GetTop() const { return top; }
+    int GetBottom() const { return bottom; }
+    const Span& GetRow(int y) const { return rows[y]; }
+};
+
 struct PixelBuffer {
     const Size size;
-    std::unique_ptr<PixelValue[]> buffer;
+    std::unique_ptr<PixelValue[]> storage;
+    PixelValue* buffer;
+    // Everything drawn since the last present
+    DamageMap damage;
+    // Parts of the buffer still holding content of an earlier frame; views
+    // use that of their parent instead, within their clip
+    DamageMap stale;
+    const DamageMap* parent_stale{};
+    // Nothing outside this is drawn to
+    const struct Rectangle clip;
 
     explicit PixelBuffer(Size size);
+    // Uses externally owned memory, such as a framebuffer page
+    PixelBuffer(Size size, PixelValue* memory);
+    // Draws to the memory of parent, but only within clip; damage is tracked
+    // separately from parent, which must outlive the view
+    PixelBuffer(const PixelBuffer& parent, const struct Rectangle& clip);
     void FilledRectangle(const struct Rectangle& r, const Colour& colour);
     const Size& GetSize() const { return size; }
+    const struct Rectangle& GetClip() const { return clip; }
+    const DamageMap& GetStale() const { return parent_stale ? *parent_stale : stale; }
 
     Colour GetPixel(const Point& point) const
     {
@@ -24,12 +102,40 @@ struct PixelBuffer {
         return FromPixelValue(buffer[point.y * size.width + point.x]);
     }
 
-    void PutPixel(const Point& point, const Colour& c)
+    void PutPixel(const Point& point, const PixelValue c)
     {
-        if (In(size, point))
+        if (In(clip, point)) {
             buffer[point.y * size.width + point.x] = c;
+            damage.Add(point.y, point.x, point.x + 1);
+        }
     }
 
+    // For callers that write to buffer directly
+    void MarkDamaged(const struct Rectangle& r) { damage.Add(ClipTo(r, clip)); }
+
+    // Fills everything left over from earlier frames; the rest of the buffer
+    // is assumed to be of this colour already
+    void Clear(const Colour& colour);
+    // As Clear(), but takes the pixels from a buffer of the same size
+    void Restore(const PixelBuffer& background);
+    // Makes all of the buffer stale, for when the assumption above no longer holds
+    void Invalidate() { stale.Add(::Rectangle{{}, size}); }
+
+    // Called once the buffer has been presented: what was drawn becomes stale
+    void EndFrame();
+
+    // Fills [span.x0, span.x1) of row y, clipped
+    void FillSpan(int y, const Span& span, const PixelValue colour);
+    // Both end points are included, as with Line()
+    void HLine(int x0, int x1, int y, const PixelValue colour);
+    void VLine(int x, int y0, int y1, const PixelValue colour);
+
+    // Blends colour into the rectangle at point using an 8-bit coverage mask
+    // of the given size; stride is the distance between mask rows
+    void BlendMask(const Point& point, const Size& mask_size, const uint8_t* mask, int stride, const PixelValue colour);
+    // As above, but nothing outside mask_clip is touched either
+    void BlendMask(const Point& point, const Size& mask_size, const uint8_t* mask, int stride, const PixelValue colour, const struct Rectangle& mask_clip);
+
     void Line(const Point& from, const Point& to, const Colour& colour);
     void Rectangle(const Rectangle& r, const Colour& colour);
 };
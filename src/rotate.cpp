@@ -0,0 +1,35 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "rotate.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rotate {
+
+void Reverse(PixelValue* dest, const PixelValue* source, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    for (; n + 4 <= count; n += 4) {
+        const auto v = vrev64q_u32(vld1q_u32(source + count - n - 4));
+        vst1q_u32(dest + n, vcombine_u32(vget_high_u32(v), vget_low_u32(v)));
+    }
+#elif defined(__SSE2__)
+    for (; n + 4 <= count; n += 4) {
+        const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + count - n - 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#endif
+    for (; n < count; ++n)
+        dest[n] = source[count - 1 - n];
+}
+
+}
@@ -0,0 +1,24 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include "types.h"
+
+namespace rotate {
+
+// Clockwise
+enum class Rotation {
+    None,
+    Degrees90,
+    Degrees180,
+    Degrees270,
+};
+
+// dest[n] = source[count - 1 - n]
+void Reverse(PixelValue* dest, const PixelValue* source, int count);
+
+}
@@ -0,0 +1,205 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "scale.h"
+#include <algorithm>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace scale {
+
+namespace {
+
+// Red/blue and alpha/green are interpolated in pairs; each channel has 16
+// bits of room, which the weighted sum never exceeds
+inline PixelValue LerpPixel(const PixelValue a, const PixelValue b, const unsigned weight)
+{
+    const auto rb = ((a & 0x00ff00ff) * (256 - weight) + (b & 0x00ff00ff) * weight) >> 8;
+    const auto ag = ((a >> 8) & 0x00ff00ff) * (256 - weight) + ((b >> 8) & 0x00ff00ff) * weight;
+    return (rb & 0x00ff00ff) | (ag & 0xff00ff00);
+}
+
+// dest[n] = LerpPixel(source[index[n]], source[index[n] + 1], weight[4 * n])
+void LerpColumns(PixelValue* dest, const PixelValue* source, const int* index, const std::uint16_t* weight, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    for (; n + 4 <= count; n += 4) {
+        const auto i = index + n;
+        const uint32_t a[4]{source[i[0]], source[i[1]], source[i[2]], source[i[3]]};
+        const uint32_t b[4]{source[i[0] + 1], source[i[1] + 1], source[i[2] + 1], source[i[3] + 1]};
+        const auto va = vreinterpretq_u8_u32(vld1q_u32(a));
+        const auto vb = vreinterpretq_u8_u32(vld1q_u32(b));
+        const auto wlo = vld1q_u16(weight + 4 * n);
+        const auto whi = vld1q_u16(weight + 4 * n + 8);
+        const auto all = vdupq_n_u16(256);
+        const auto lo = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(va)), vsubq_u16(all, wlo)), vmovl_u8(vget_low_u8(vb)), wlo);
+        const auto hi = vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(va)), vsubq_u16(all, whi)), vmovl_u8(vget_high_u8(vb)), whi);
+        vst1q_u32(dest + n, vreinterpretq_u32_u8(vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8))));
+    }
+#elif defined(__SSE2__)
+    const auto zero = _mm_setzero_si128();
+    const auto all = _mm_set1_epi16(256);
+    const auto lerp = [&](__m128i va, __m128i vb, __m128i w) {
+        return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(va, _mm_sub_epi16(all, w)), _mm_mullo_epi16(vb, w)), 8);
+    };
+    for (; n + 4 <= count; n += 4) {
+        const auto i = index + n;
+        // Each load takes both source pixels of a column
+        const auto load = [&](int k) { return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i[k])); };
+        const auto p01 = _mm_castsi128_ps(_mm_unpacklo_epi64(load(0), load(1)));
+        const auto p23 = _mm_castsi128_ps(_mm_unpacklo_epi64(load(2), load(3)));
+        const auto va = _mm_castps_si128(_mm_shuffle_ps(p01, p23, _MM_SHUFFLE(2, 0, 2, 0)));
+        const auto vb = _mm_castps_si128(_mm_shuffle_ps(p01, p23, _MM_SHUFFLE(3, 1, 3, 1)));
+        const auto wlo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weight + 4 * n));
+        const auto whi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weight + 4 * n + 8));
+        const auto lo = lerp(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero), wlo);
+        const auto hi = lerp(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero), whi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; n < count; ++n)
+        dest[n] = LerpPixel(source[index[n]], source[index[n] + 1], weight[4 * n]);
+}
+
+}
+
+void Duplicate(PixelValue* dest, const PixelValue* source, const int count, const int factor)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    if (factor == 2) {
+        for (; n + 4 <= count; n += 4) {
+            const auto v = vld1q_u32(source + n);
+            const auto pairs = vzipq_u32(v, v);
+            vst1q_u32(dest + 2 * n, pairs.val[0]);
+            vst1q_u32(dest + 2 * n + 4, pairs.val[1]);
+        }
+    } else if (factor >= 4) {
+        // The last store overlaps the one before when factor is not a
+        // multiple of 4
+        for (; n < count; ++n) {
+            const auto v = vdupq_n_u32(source[n]);
+            auto d = dest + n * factor;
+            for (int k = 0; k + 4 <= factor; k += 4)
+                vst1q_u32(d + k, v);
+            vst1q_u32(d + factor - 4, v);
+        }
+    }
+#elif defined(__SSE2__)
+    if (factor == 2) {
+        for (; n + 4 <= count; n += 4) {
+            const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 2 * n), _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 2 * n + 4), _mm_unpackhi_epi32(v, v));
+        }
+    } else if (factor >= 4) {
+        for (; n < count; ++n) {
+            const auto v = _mm_set1_epi32(static_cast<int>(source[n]));
+            auto d = dest + n * factor;
+            for (int k = 0; k + 4 <= factor; k += 4)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(d + k), v);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d + factor - 4), v);
+        }
+    }
+#endif
+    for (; n < count; ++n) {
+        for (int k = 0; k < factor; ++k)
+            dest[n * factor + k] = source[n];
+    }
+}
+
+void Lerp(PixelValue* dest, const PixelValue* a, const PixelValue* b, const int weight, const int count)
+{
+    int n = 0;
+#if defined(__ARM_NEON)
+    const auto wa = static_cast<uint16_t>(256 - weight);
+    const auto wb = static_cast<uint16_t>(weight);
+    for (; n + 4 <= count; n += 4) {
+        const auto va = vreinterpretq_u8_u32(vld1q_u32(a + n));
+        const auto vb = vreinterpretq_u8_u32(vld1q_u32(b + n));
+        const auto lo = vmlaq_n_u16(vmulq_n_u16(vmovl_u8(vget_low_u8(va)), wa), vmovl_u8(vget_low_u8(vb)), wb);
+        const auto hi = vmlaq_n_u16(vmulq_n_u16(vmovl_u8(vget_high_u8(va)), wa), vmovl_u8(vget_high_u8(vb)), wb);
+        vst1q_u32(dest + n, vreinterpretq_u32_u8(vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8))));
+    }
+#elif defined(__SSE2__)
+    const auto zero = _mm_setzero_si128();
+    const auto wa = _mm_set1_epi16(static_cast<short>(256 - weight));
+    const auto wb = _mm_set1_epi16(static_cast<short>(weight));
+    // Products and their sum fit in 16 unsigned bits, so wrapping
+    // arithmetic and a logical shift give the exact result
+    const auto lerp = [&](__m128i va, __m128i vb) {
+        return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(va, wa), _mm_mullo_epi16(vb, wb)), 8);
+    };
+    for (; n + 4 <= count; n += 4) {
+        const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + n));
+        const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + n));
+        const auto lo = lerp(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+        const auto hi = lerp(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; n < count; ++n)
+        dest[n] = LerpPixel(a[n], b[n], weight);
+}
+
+Scaler::Scaler(const Size& from, const Size& to, const Filter filter)
+    : from(from), to(to), filter(filter)
+    , column(to.width), row(to.height), column_weight(4 * to.width), row_weight(to.height)
+    , blended(from.width + 1)
+{
+    if (to.width % from.width == 0)
+        x_factor = to.width / from.width;
+
+    const auto sample = [&](int source_size, int dest_size, std::vector<int>& index, std::vector<std::uint16_t>& weight) {
+        const auto lanes = weight.size() / dest_size;
+        for (int d = 0; d < dest_size; ++d) {
+            if (filter == Filter::Nearest) {
+                index[d] = d * source_size / dest_size;
+                continue;
+            }
+            // Pixel centres line up, in 1/256th of a source pixel
+            const auto pos = std::clamp((2 * d + 1) * source_size * 128 / dest_size - 128, 0, (source_size - 1) * 256);
+            index[d] = pos >> 8;
+            std::fill_n(&weight[d * lanes], lanes, pos & 255);
+        }
+    };
+    sample(from.width, to.width, column, column_weight);
+    sample(from.height, to.height, row, row_weight);
+}
+
+void Scaler::Row(PixelValue* dest, const PixelValue* source, const int y, const int x0, const int x1)
+{
+    if (x0 >= x1)
+        return;
+
+    const auto top = source + row[y] * from.width;
+    if (filter == Filter::Nearest) {
+        if (x_factor > 0 && x0 % x_factor == 0 && x1 % x_factor == 0) {
+            Duplicate(dest, top + x0 / x_factor, (x1 - x0) / x_factor, x_factor);
+            return;
+        }
+        for (int x = x0; x < x1; ++x)
+            *dest++ = top[column[x]];
+        return;
+    }
+
+    // Interpolate the source columns needed between both rows first, so that
+    // this is done once per source pixel rather than once per pixel
+    const auto bottom = source + std::min(row[y] + 1, from.height - 1) * from.width;
+    const auto c0 = column[x0];
+    const auto c1 = std::min(column[x1 - 1] + 2, from.width);
+    Lerp(&blended[c0], top + c0, bottom + c0, row_weight[y], c1 - c0);
+    if (c1 == from.width)
+        blended[from.width] = blended[from.width - 1];
+    LerpColumns(dest, blended.data(), &column[x0], &column_weight[4 * x0], x1 - x0);
+}
+
+}
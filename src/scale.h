@@ -0,0 +1,62 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "types.h"
+
+namespace scale {
+
+enum class Filter {
+    // Every source pixel becomes a block of pixels
+    Nearest,
+    // Interpolates between the four source pixels closest to each pixel
+    Bilinear,
+};
+
+// Writes each of count source pixels factor times
+void Duplicate(PixelValue* dest, const PixelValue* source, int count, int factor);
+
+// Blends every channel of a and b as a + (b - a) * weight / 256, with
+// weight in [0, 256]
+void Lerp(PixelValue* dest, const PixelValue* a, const PixelValue* b, int weight, int count);
+
+// Scales rows of a buffer of one size up to another size
+class Scaler
+{
+    const Size from;
+    const Size to;
+    const Filter filter;
+    // Set if to.width is a whole multiple of from.width
+    int x_factor{};
+    // Source position of each destination column and row; for bilinear
+    // filtering, the weight of the next source pixel is in [0, 256]. Column
+    // weights are repeated for each of the four channels
+    std::vector<int> column, row;
+    std::vector<std::uint16_t> column_weight, row_weight;
+    // Source row after vertical interpolation, with its last pixel repeated
+    std::vector<PixelValue> blended;
+
+public:
+    Scaler(const Size& from, const Size& to, const Filter filter);
+
+    const Size& GetSourceSize() const { return from; }
+    const Size& GetSize() const { return to; }
+    Filter GetFilter() const { return filter; }
+
+    // Source pixels [x0, x1) are nearest to destination pixels
+    // [MapX(x0), MapX(x1)); likewise for rows
+    int MapX(const int x) const { return (x * to.width + from.width - 1) / from.width; }
+    int MapY(const int y) const { return (y * to.height + from.height - 1) / from.height; }
+
+    // Writes pixels [x0, x1) of destination row y to dest, which points to
+    // the pixel at x0; source holds all of the source pixels
+    void Row(PixelValue* dest, const PixelValue* source, int y, int x0, int x1);
+};
+
+}
@@ -0,0 +1,102 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "scheduler.h"
+#include <algorithm>
+#include <cerrno>
+#include <numeric>
+#include <vector>
+#include <time.h>
+
+namespace {
+
+// Stop handling events this long before the deadline, as select() and
+// friends tend to oversleep a bit
+constexpr auto EventMargin = std::chrono::microseconds{500};
+
+}
+
+FrameScheduler::FrameScheduler(int fps)
+    : frame_period(fps > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::seconds{1}) / fps : Clock::duration{})
+{
+    frame_start = Clock::now();
+    deadline = frame_start;
+}
+
+void FrameScheduler::Record(Clock::duration frame_time)
+{
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(frame_time).count();
+    history[frames % HistoryLength] = static_cast<uint32_t>(std::clamp<int64_t>(us, 0, UINT32_MAX));
+    history_count = std::min(history_count + 1, HistoryLength);
+    ++frames;
+}
+
+void FrameScheduler::SleepUntil(Clock::time_point t)
+{
+    // steady_clock is CLOCK_MONOTONIC on Linux
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    struct timespec ts;
+    ts.tv_sec = ns / 1'000'000'000;
+    ts.tv_nsec = ns % 1'000'000'000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        ;
+}
+
+void FrameScheduler::Wait(const EventHandler& handle_events)
+{
+    auto now = Clock::now();
+    Record(now - frame_start);
+
+    if (frame_period == Clock::duration{}) {
+        if (handle_events)
+            handle_events(std::chrono::microseconds{0});
+        frame_start = Clock::now();
+        return;
+    }
+
+    deadline += frame_period;
+    if (now > deadline) {
+        // Skip the deadlines we missed rather than trying to catch up
+        const auto missed = (now - deadline) / frame_period + 1;
+        dropped += missed;
+        deadline += missed * frame_period;
+    }
+
+    if (handle_events) {
+        while (true) {
+            const auto slack = std::chrono::duration_cast<std::chrono::microseconds>(deadline - Clock::now()) - EventMargin;
+            if (slack <= std::chrono::microseconds{0})
+                break;
+            handle_events(slack);
+        }
+    }
+
+    if (vsync && vsync()) {
+        // The display sets the pace; align the next deadline to it
+        deadline = Clock::now();
+    } else {
+        SleepUntil(deadline);
+    }
+    frame_start = Clock::now();
+}
+
+FrameStatistics FrameScheduler::GetStatistics() const
+{
+    FrameStatistics stats;
+    stats.frames = frames;
+    stats.dropped = dropped;
+    if (history_count == 0)
+        return stats;
+
+    std::vector<uint32_t> samples(history.begin(), history.begin() + history_count);
+    const auto sum = std::accumulate(samples.begin(), samples.end(), uint64_t{0});
+    stats.average = std::chrono::microseconds{sum / samples.size()};
+    stats.min = std::chrono::microseconds{*std::min_element(samples.begin(), samples.end())};
+    const auto p99 = samples.begin() + (samples.size() * 99) / 100;
+    std::nth_element(samples.begin(), p99, samples.end());
+    stats.p99 = std::chrono::microseconds{*p99};
+    return stats;
+}
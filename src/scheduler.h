@@ -0,0 +1,56 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+struct FrameStatistics {
+    // Time spent on each frame, over the last FrameScheduler::HistoryLength frames
+    std::chrono::microseconds min{}, average{}, p99{};
+    uint64_t frames{};
+    // Deadlines missed since the scheduler was created
+    uint64_t dropped{};
+};
+
+class FrameScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+    using EventHandler = std::function<void(std::chrono::microseconds timeout)>;
+    using VSyncWaiter = std::function<bool()>;
+    static constexpr inline size_t HistoryLength = 256;
+
+private:
+    const Clock::duration frame_period;
+    Clock::time_point deadline;
+    Clock::time_point frame_start;
+    VSyncWaiter vsync;
+    std::array<uint32_t, HistoryLength> history{};
+    size_t history_count{};
+    uint64_t frames{};
+    uint64_t dropped{};
+
+    void Record(Clock::duration frame_time);
+    void SleepUntil(Clock::time_point t);
+
+public:
+    // An fps of 0 means frames are not paced at all
+    explicit FrameScheduler(int fps);
+
+    // When set, used to wait for the display instead of sleeping until the
+    // deadline; it returns false if it could not wait
+    void SetVSync(VSyncWaiter waiter) { vsync = std::move(waiter); }
+
+    // Call once the frame has been presented: handle_events gets called with
+    // the slack left before the next frame is due, after which this returns
+    // at the deadline
+    void Wait(const EventHandler& handle_events);
+
+    FrameStatistics GetStatistics() const;
+};
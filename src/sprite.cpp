@@ -0,0 +1,87 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#include "sprite.h"
+#include <algorithm>
+#include <cstring>
+#include "blend.h"
+#include "pixelbuffer.h"
+
+namespace sprite {
+
+namespace {
+    enum class Kind { Transparent, Opaque, Blend };
+}
+
+template<typename Classify>
+void Sprite::Encode(const PixelBuffer& image, Classify classify)
+{
+    size = image.GetSize();
+    row_start.reserve(size.height + 1);
+    for (int y = 0; y < size.height; ++y) {
+        row_start.push_back(runs.size());
+        const auto row = &image.buffer[y * size.width];
+        for (int x = 0; x < size.width;) {
+            const auto kind = classify(row[x]);
+            auto end = x + 1;
+            while (end < size.width && classify(row[end]) == kind)
+                ++end;
+            if (kind != Kind::Transparent) {
+                runs.push_back(Run{static_cast<uint16_t>(x), static_cast<uint16_t>(end - x), kind == Kind::Blend,
+                    static_cast<uint32_t>(pixels.size())});
+                pixels.insert(pixels.end(), row + x, row + end);
+            }
+            x = end;
+        }
+    }
+    row_start.push_back(runs.size());
+}
+
+Sprite::Sprite(const PixelBuffer& image, const PixelValue key)
+{
+    Encode(image, [&](const PixelValue v) {
+        return v == key ? Kind::Transparent : Kind::Opaque;
+    });
+}
+
+Sprite::Sprite(const PixelBuffer& image)
+{
+    Encode(image, [](const PixelValue v) {
+        const auto alpha = v >> 24;
+        if (alpha == 0) return Kind::Transparent;
+        if (alpha == 255) return Kind::Opaque;
+        return Kind::Blend;
+    });
+}
+
+void Sprite::Draw(PixelBuffer& pb, const Point& p) const
+{
+    const auto visible = ClipTo(Rectangle{p, size}, pb.GetClip());
+    if (visible.size.width <= 0 || visible.size.height <= 0)
+        return;
+
+    // Columns of the sprite that are visible
+    const auto left = visible.point.x - p.x;
+    const auto right = left + visible.size.width;
+    for (int y = visible.point.y - p.y; y < visible.point.y - p.y + visible.size.height; ++y) {
+        const auto dest_row = &pb.buffer[(p.y + y) * pb.GetSize().width];
+        for (auto n = row_start[y]; n < row_start[y + 1]; ++n) {
+            const auto& run = runs[n];
+            const auto x0 = std::max<int>(run.x, left);
+            const auto x1 = std::min<int>(run.x + run.length, right);
+            if (x0 >= x1)
+                continue;
+            const auto source = &pixels[run.offset + x0 - run.x];
+            if (run.blend)
+                blend::Alpha(dest_row + p.x + x0, source, x1 - x0);
+            else
+                std::memcpy(dest_row + p.x + x0, source, (x1 - x0) * sizeof(PixelValue));
+        }
+    }
+    pb.MarkDamaged(visible);
+}
+
+}
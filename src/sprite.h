@@ -0,0 +1,51 @@
+/*-
+ * SPDX-License-Identifier: CC-BY-4.0
+ *
+ * Copyright (c) 2023 Rink Springer <rink@rink.nu>
+ * For conditions of distribution and use, see LICENSE file
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "types.h"
+
+struct PixelBuffer;
+
+namespace sprite {
+
+// An image stored as runs of visible pixels per row, so that drawing skips
+// transparent pixels without looking at them
+class Sprite
+{
+    struct Run
+    {
+        std::uint16_t x;
+        std::uint16_t length;
+        // Runs either replace the destination or blend with it by alpha
+        bool blend;
+        // Index of the first pixel in pixels
+        std::uint32_t offset;
+    };
+
+    Size size;
+    std::vector<PixelValue> pixels;
+    // The runs of row y are [row_start[y], row_start[y + 1])
+    std::vector<Run> runs;
+    std::vector<std::uint32_t> row_start;
+
+    template<typename Classify>
+    void Encode(const PixelBuffer& image, Classify classify);
+
+public:
+    // Pixels equal to key are transparent, all others opaque
+    Sprite(const PixelBuffer& image, const PixelValue key);
+    // Pixels are blended by their alpha channel
+    explicit Sprite(const PixelBuffer& image);
+
+    const auto& GetSize() const { return size; }
+    // Draws the sprite with its top-left corner at p, clipped to the clip of pb
+    void Draw(PixelBuffer& pb, const Point& p) const;
+};
+
+}
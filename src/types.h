@@ -56,8 +56,8 @@ constexpr Rectangle ClipTo(const Rectangle& r, const Rectangle& range)
         result.size.height -= range.point.y - result.point.y;
         result.point.y = range.point.y;
     }
-    result.size.height = std::min(result.size.height, range.size.height);
-    result.size.width = std::min(result.size.width, range.size.width);
+    result.size.width = std::clamp(result.size.width, 0, std::max(range.point.x + range.size.width - result.point.x, 0));
+    result.size.height = std::clamp(result.size.height, 0, std::max(range.point.y + range.size.height - result.point.y, 0));
     return result;
 }
 
@@ -80,6 +80,19 @@ constexpr Colour Blend(const Colour& source1, const Colour& source2, const float
     return result;
 }
 
+// 8-bit fixed point version of Blend() on packed pixels, blending all four
+// channels two at a time: alpha 0 yields source1, 255 yields source2. The
+// division by 255 is rounded, so results are within 1 of Blend()
+constexpr PixelValue BlendPixel(const PixelValue source1, const PixelValue source2, const uint32_t alpha)
+{
+    const auto inverse = 255 - alpha;
+    auto rb = (source1 & 0x00ff00ff) * inverse + (source2 & 0x00ff00ff) * alpha + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    auto ag = ((source1 >> 8) & 0x00ff00ff) * inverse + ((source2 >> 8) & 0x00ff00ff) * alpha + 0x00800080;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+    return rb | ag;
+}
+
 constexpr bool In(const Size& size, const Point& p) { return In(Rectangle{{}, size}, p); }
 
 constexpr Point operator-(const Point& p) { return Point{-p.x, -p.y}; }
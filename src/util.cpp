@@ -6,6 +6,7 @@
  */
 #include "util.h"
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <stdexcept>
 #include <unistd.h>
 #include <vector>
@@ -34,6 +35,88 @@ std::vector<std::byte> ReadFile(const char* path)
     return result;
 }
 
+MappedFile::MappedFile(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("cannot open file");
+
+    struct DerefClose {
+        ~DerefClose() { close(fd); }
+        int fd;
+    } dc{fd};
+
+    const auto file_size = lseek(fd, 0, SEEK_END);
+    if (file_size == static_cast<off_t>(-1))
+        throw std::runtime_error("cannot seek file");
+    if (file_size == 0)
+        throw std::runtime_error("file is empty");
+
+    void* p = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("cannot map file");
+    data = static_cast<const std::byte*>(p);
+    size = file_size;
+}
+
+MappedFile::~MappedFile()
+{
+    munmap(const_cast<std::byte*>(data), size);
+}
+
+char32_t NextCodepoint(std::string_view& sv)
+{
+    const auto byte = [&](size_t n) { return static_cast<unsigned char>(sv[n]); };
+    const auto lead = byte(0);
+
+    size_t length;
+    char32_t cp, min;
+    if (lead < 0x80) {
+        sv.remove_prefix(1);
+        return lead;
+    } else if ((lead & 0xe0) == 0xc0) {
+        length = 2, cp = lead & 0x1f, min = 0x80;
+    } else if ((lead & 0xf0) == 0xe0) {
+        length = 3, cp = lead & 0x0f, min = 0x800;
+    } else if ((lead & 0xf8) == 0xf0) {
+        length = 4, cp = lead & 0x07, min = 0x10000;
+    } else {
+        length = 0;
+    }
+
+    bool valid = length > 0 && sv.size() >= length;
+    for (size_t n = 1; valid && n < length; ++n) {
+        valid = (byte(n) & 0xc0) == 0x80;
+        cp = cp << 6 | (byte(n) & 0x3f);
+    }
+    // Reject overlong encodings, surrogates and anything beyond Unicode
+    if (!valid || cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+        sv.remove_prefix(1);
+        return lead;
+    }
+    sv.remove_prefix(length);
+    return cp;
+}
+
+void AppendUTF8(std::string& s, char32_t codepoint)
+{
+    if (codepoint < 0x80) {
+        s += static_cast<char>(codepoint);
+    } else if (codepoint < 0x800) {
+        s += static_cast<char>(0xc0 | codepoint >> 6);
+        s += static_cast<char>(0x80 | (codepoint & 0x3f));
+    } else if (codepoint < 0x10000) {
+        s += static_cast<char>(0xe0 | codepoint >> 12);
+        s += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+        s += static_cast<char>(0x80 | (codepoint & 0x3f));
+    } else {
+        s += static_cast<char>(0xf0 | codepoint >> 18);
+        s += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
+        s += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+        s += static_cast<char>(0x80 | (codepoint & 0x3f));
+    }
+}
+
 TextFile::TextFile(std::vector<std::byte> input)
     : buffer(std::move(input))
 {
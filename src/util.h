@@ -6,6 +6,9 @@
  */
 #pragma once
 
+#include <cstdint>
+#include <span>
+#include <string>
 #include <vector>
 #include <string_view>
 
@@ -13,6 +16,45 @@ namespace util {
 
 std::vector<std::byte> ReadFile(const char* path);
 
+// Read-only mapping of an entire file
+class MappedFile {
+    const std::byte* data{};
+    size_t size{};
+public:
+    MappedFile(const char* path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::span<const std::byte> GetData() const { return { data, size }; }
+};
+
+// Decodes the codepoint at the start of sv and removes it from sv; bytes
+// that do not form valid UTF-8 are taken as Latin-1
+char32_t NextCodepoint(std::string_view& sv);
+void AppendUTF8(std::string& s, char32_t codepoint);
+
+// xorshift32; far cheaper than std::mt19937 and its distributions, and
+// random enough for visuals
+class XorShift {
+    std::uint32_t state;
+public:
+    // The state must never be zero
+    explicit XorShift(std::uint32_t seed) : state(seed != 0 ? seed : 0x9e3779b9) { }
+
+    std::uint32_t operator()()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Uniform in [0, n), scaling rather than taking the remainder
+    std::uint32_t Below(std::uint32_t n) { return static_cast<std::uint32_t>((std::uint64_t{ (*this)() } * n) >> 32); }
+};
+
 class TextFile {
     std::vector<std::byte> buffer;
     std::vector<std::string_view> strings;